@@ -0,0 +1,253 @@
+/*
+**
+* BEGIN_COPYRIGHT
+*
+* Copyright (C) 2008-2016 SciDB, Inc.
+* All Rights Reserved.
+*
+* faster_redimension is a plugin for SciDB, an Open Source Array DBMS maintained
+* by Paradigm4. See http://www.paradigm4.com/
+*
+* faster_redimension is free software: you can redistribute it and/or modify
+* it under the terms of the AFFERO GNU General Public License as published by
+* the Free Software Foundation.
+*
+* faster_redimension is distributed "AS-IS" AND WITHOUT ANY WARRANTY OF ANY KIND,
+* INCLUDING ANY IMPLIED WARRANTY OF MERCHANTABILITY,
+* NON-INFRINGEMENT, OR FITNESS FOR A PARTICULAR PURPOSE. See
+* the AFFERO GNU General Public License for the complete license terms.
+*
+* You should have received a copy of the AFFERO GNU General Public License
+* along with faster_redimension.  If not, see <http://www.gnu.org/licenses/agpl-3.0.html>
+*
+* END_COPYRIGHT
+*/
+
+#ifndef AGGREGATES_H_
+#define AGGREGATES_H_
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "FasterRedimensionSettings.h"
+#include "RedimensionTuple.h"
+
+namespace scidb
+{
+namespace faster_redimension
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+ * The partial states of aggregate=... (see AggregateSpec). A state is [uint64 count] for count and
+ * [uint64 count][8-byte value] for the rest. The value is widened to int64, uint64 or double after the input - avg
+ * always keeps a double sum. States are combined wherever two tuples meet at one position: in TupleSgArray as the
+ * tuples are packed for the SG, and in the OutputWriter after the merge. Only the OutputWriter turns them into output
+ * values.
+ */
+class Aggregates
+{
+private:
+    static uint64_t getCount(char const* state)
+    {
+        uint64_t result;
+        memcpy(&result, state, sizeof(uint64_t));
+        return result;
+    }
+
+    static void setCount(char* state, uint64_t const count)
+    {
+        memcpy(state, &count, sizeof(uint64_t));
+    }
+
+    template <typename T>
+    static T getValue(char const* state)
+    {
+        T result;
+        memcpy(&result, state + sizeof(uint64_t), sizeof(T));
+        return result;
+    }
+
+    template <typename T>
+    static void setValue(char* state, T const value)
+    {
+        memcpy(state + sizeof(uint64_t), &value, sizeof(T));
+    }
+
+    template <typename T>
+    static T read(char const* data)
+    {
+        T result;
+        memcpy(&result, data, sizeof(T));
+        return result;
+    }
+
+    template <typename T>
+    static void combineValue(AggregateFunction const function, char* state, char const* other)
+    {
+        T const a = getValue<T>(state);
+        T const b = getValue<T>(other);
+        switch(function)
+        {
+        case AGGREGATE_MIN: setValue<T>(state, std::min(a, b)); break;
+        case AGGREGATE_MAX: setValue<T>(state, std::max(a, b)); break;
+        default:            setValue<T>(state, a + b);          break;
+        }
+    }
+
+    template <typename T>
+    static void append(vector<char>& data, T const value)
+    {
+        char const* bytes = reinterpret_cast<char const*>(&value);
+        data.insert(data.end(), bytes, bytes + sizeof(T));
+    }
+
+    //avg sums doubles whatever the input
+    static AggregateValueKind getStateKind(AggregateSpec const& a)
+    {
+        return a.function == AGGREGATE_AVG ? AGGREGATE_VALUE_FLOAT : a.kind;
+    }
+
+public:
+    static void init(AggregateSpec const& a, AttributeView const* input, char* state)
+    {
+        if(a.function == AGGREGATE_COUNT)
+        {
+            setCount(state, input == NULL || input->missingReason < 0 ? 1 : 0);
+            return;
+        }
+        if(input->missingReason >= 0)
+        {
+            setCount(state, 0);
+            setValue<uint64_t>(state, 0);
+            return;
+        }
+        setCount(state, 1);
+        char const* data = input->data;
+        int64_t  s = 0;
+        uint64_t u = 0;
+        double   d = 0;
+        switch(a.kind)
+        {
+        case AGGREGATE_VALUE_SIGNED:
+            s = a.inputSize == 1 ? read<int8_t>(data)  : a.inputSize == 2 ? read<int16_t>(data)  :
+                a.inputSize == 4 ? read<int32_t>(data) : read<int64_t>(data);
+            d = static_cast<double>(s);
+            break;
+        case AGGREGATE_VALUE_UNSIGNED:
+            u = a.inputSize == 1 ? read<uint8_t>(data)  : a.inputSize == 2 ? read<uint16_t>(data)  :
+                a.inputSize == 4 ? read<uint32_t>(data) : read<uint64_t>(data);
+            d = static_cast<double>(u);
+            break;
+        case AGGREGATE_VALUE_FLOAT:
+            d = a.inputSize == sizeof(float) ? read<float>(data) : read<double>(data);
+            break;
+        }
+        switch(getStateKind(a))
+        {
+        case AGGREGATE_VALUE_SIGNED:   setValue<int64_t>(state, s);  break;
+        case AGGREGATE_VALUE_UNSIGNED: setValue<uint64_t>(state, u); break;
+        case AGGREGATE_VALUE_FLOAT:    setValue<double>(state, d);   break;
+        }
+    }
+
+    static void combine(AggregateSpec const& a, char* state, char const* other)
+    {
+        uint64_t const count = getCount(other);
+        if(count == 0)
+        {
+            return;
+        }
+        if(a.function == AGGREGATE_COUNT || getCount(state) == 0)
+        {
+            if(a.function != AGGREGATE_COUNT)
+            {
+                memcpy(state + sizeof(uint64_t), other + sizeof(uint64_t), sizeof(uint64_t));
+            }
+            setCount(state, getCount(state) + count);
+            return;
+        }
+        switch(getStateKind(a))
+        {
+        case AGGREGATE_VALUE_SIGNED:   combineValue<int64_t>(a.function, state, other);  break;
+        case AGGREGATE_VALUE_UNSIGNED: combineValue<uint64_t>(a.function, state, other); break;
+        case AGGREGATE_VALUE_FLOAT:    combineValue<double>(a.function, state, other);   break;
+        }
+        setCount(state, getCount(state) + count);
+    }
+
+    /*
+     * Append the output value of a state to data and return its missing reason: 0 (null) if no value was
+     * aggregated, -1 otherwise. count is never null.
+     */
+    static int8_t finalize(AggregateSpec const& a, char const* state, vector<char>& data)
+    {
+        uint64_t const count = getCount(state);
+        if(a.function == AGGREGATE_COUNT)
+        {
+            append<uint64_t>(data, count);
+            return -1;
+        }
+        if(count == 0)
+        {
+            return 0;
+        }
+        if(a.function == AGGREGATE_AVG)
+        {
+            append<double>(data, getValue<double>(state) / count);
+            return -1;
+        }
+        if(a.function == AGGREGATE_SUM)
+        {
+            data.insert(data.end(), state + sizeof(uint64_t), state + 2 * sizeof(uint64_t));
+            return -1;
+        }
+        switch(a.kind) //min and max: back to the input type
+        {
+        case AGGREGATE_VALUE_SIGNED:
+        {
+            int64_t const v = getValue<int64_t>(state);
+            switch(a.outputSize)
+            {
+            case 1:  append<int8_t>(data, v);  break;
+            case 2:  append<int16_t>(data, v); break;
+            case 4:  append<int32_t>(data, v); break;
+            default: append<int64_t>(data, v); break;
+            }
+            break;
+        }
+        case AGGREGATE_VALUE_UNSIGNED:
+        {
+            uint64_t const v = getValue<uint64_t>(state);
+            switch(a.outputSize)
+            {
+            case 1:  append<uint8_t>(data, v);  break;
+            case 2:  append<uint16_t>(data, v); break;
+            case 4:  append<uint32_t>(data, v); break;
+            default: append<uint64_t>(data, v); break;
+            }
+            break;
+        }
+        case AGGREGATE_VALUE_FLOAT:
+        {
+            double const v = getValue<double>(state);
+            if(a.outputSize == sizeof(float))
+            {
+                append<float>(data, v);
+            }
+            else
+            {
+                append<double>(data, v);
+            }
+            break;
+        }
+        }
+        return -1;
+    }
+};
+
+} } //namespaces
+
+#endif /* AGGREGATES_H_ */
@@ -27,9 +27,15 @@
 #define ARRAYIO_H_
 
 #include "FasterRedimensionSettings.h"
+#include "MemoryGovernor.h"
 #include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
 #include <util/Network.h>
 #include "RedimensionTuple.h"
+#include "Aggregates.h"
 
 namespace scidb
 {
@@ -43,6 +49,16 @@ namespace faster_redimension
  * This pulls values out of the input array and converts them to tuples. It is used twice:
  *  - reading input prior to sort
  *  - reading sorted array into sg
+ * When reading the input, the work that does not need attribute values is done a block of cells at a time: the
+ * lead iterator - the first attribute that becomes an output dimension or, if there is none, the empty tag - is
+ * drained for the block to record the input positions, and so are the other attributes that become dimensions,
+ * into int64 columns. Then validity, output chunk, instance and cell position are computed for the whole block.
+ * Neighbouring input cells nearly always land in the same output chunk, so the instance is only looked up again
+ * when the chunk changes. The attributes that become output attributes (or feed aggregates) are not decoded into
+ * the block at all: their iterators trail behind and are stepped to each row as next() reaches it, and the tuple is
+ * assembled straight from their current items, so values are copied once, into the tuple. If no input attribute
+ * is read, only the positions of the empty tag are walked and no values are fetched at all. The number and size of
+ * the tuples made are reported once per block, to the scan phase and to the MemoryGovernor if one is given.
  */
 enum ArrayReadMode
 {
@@ -54,50 +70,114 @@ template<ArrayReadMode MODE>
 class ArrayReader
 {
 private:
+    static size_t const INPUT_BLOCK_SIZE = 4096;
+
+    /**
+     * One input attribute that becomes an output dimension, decoded for a block of cells.
+     */
+    struct InputColumn
+    {
+        vector<int8_t>  missing;
+        vector<int64_t> coords;
+    };
+
     shared_ptr<Array>                       _input;
     Settings const&                         _settings;
+    MemoryGovernor*                         _governor;
+    size_t const                            _numAttributesRead;
+    size_t const                            _leadIterator;
     size_t const                            _numIterators;
-    vector<Value const*>                    _tupleInputs;
-    vector<Value>                           _inputDimensionVals;
+    vector<char>                            _isCoordinateColumn;
+    vector<AttributeView>                   _tupleInputs;
+    vector<AttributeView>                   _itemViews;       //per read attribute: its item at the current row
+    vector<char>                            _aggregateStates; //one 16-byte slot per aggregate
+    vector<int64_t>                         _inputDimensionVals;
     vector<shared_ptr<ConstArrayIterator> > _aiters;
     vector<shared_ptr<ConstChunkIterator> > _citers;
+    vector<size_t>                          _iteratorRows;    //per trailing iterator: the chunk row it is on
     Coordinates                             _cellCoords;
     Coordinates                             _chunkCoords;
-    uint32_t                                _dstInstanceId;
-    position_t                              _cellLPos;
+    Coordinates                             _lastChunkCoords;
+    uint32_t                                _lastInstanceId;
     Value                                   _tupleValue;
     Value const*                            _tupleOutput;
+    vector<InputColumn>                     _columns;
+    vector<Coordinate>                      _blockPositions;
+    vector<Coordinate>                      _blockChunkCoords;
+    vector<uint32_t>                        _blockInstanceIds;
+    vector<position_t>                      _blockCellPositions;
+    vector<char>                            _blockValid;
+    size_t                                  _blockStart;      //chunk row of the first cell in the block
+    size_t                                  _blockSize;
+    size_t                                  _blockRow;
+    size_t                                  _tuplesMade;      //since the last block was loaded
+    size_t                                  _tupleBytes;
+
+    static bool isCoordinateColumn(Settings const& settings, size_t const i)
+    {
+        size_t const destination = settings.getInputAttributeDestinations()[i];
+        return destination >= settings.getNumOutputAttrs() && destination != Settings::AGGREGATE_INPUT_ONLY;
+    }
+
+    //The first attribute read that becomes a dimension or, if none does, the empty tag after the attributes read
+    static size_t findLeadIterator(Settings const& settings)
+    {
+        size_t i = 0;
+        while(i < settings.getNumInputAttributesRead() && !isCoordinateColumn(settings, i))
+        {
+            ++i;
+        }
+        return i;
+    }
 
 public:
-    ArrayReader( shared_ptr<Array>& input, Settings const& settings):
+    ArrayReader( shared_ptr<Array>& input, Settings const& settings, MemoryGovernor* governor = NULL):
         _input(input),
         _settings(settings),
-        _numIterators( MODE==READ_TUPLED ? 1 : (_settings.getNumInputAttributesRead() > 0 ? _settings.getNumInputAttributesRead() : 1)),
+        _governor(governor),
+        _numAttributesRead(MODE==READ_TUPLED ? 0 : _settings.getNumInputAttributesRead()),
+        _leadIterator(MODE==READ_TUPLED ? 0 : findLeadIterator(_settings)),
+        _numIterators( MODE==READ_TUPLED ? 1 : std::max(_leadIterator + 1, _numAttributesRead)),
+        _isCoordinateColumn(_numAttributesRead),
         _tupleInputs( MODE== READ_INPUT ? _settings.getNumOutputAttrs() : 0),
+        _itemViews(_numAttributesRead),
+        _aggregateStates(MODE== READ_INPUT ? _settings.getAggregates().size() * 2 * sizeof(uint64_t) : 0),
         _inputDimensionVals(MODE== READ_INPUT ? _settings.getNumInputDimensionsRead() : 0),
         _aiters(_numIterators),
         _citers(_numIterators),
+        _iteratorRows(_numIterators, 0),
         _cellCoords(_settings.getNumOutputDims()),
-        _chunkCoords(_settings.getNumOutputDims())
+        _chunkCoords(_settings.getNumOutputDims()),
+        _lastInstanceId(0),
+        _columns(_numAttributesRead),
+        _blockStart(0),
+        _blockSize(0),
+        _blockRow(0),
+        _tuplesMade(0),
+        _tupleBytes(0)
     {
         if(_settings.haveSynthetic())
         {
             _cellCoords[settings.getSyntheticId()] = settings.getSyntheticMin();
             _chunkCoords[settings.getSyntheticId()] = settings.getSyntheticMin();
         }
+        for(size_t i =0; i<_numAttributesRead; ++i)
+        {
+            _isCoordinateColumn[i] = isCoordinateColumn(_settings, i);
+        }
         for(size_t i =0; i<_numIterators; ++i)
         {
-            if(_settings.getNumInputAttributesRead() ==0)
+            if(MODE==READ_TUPLED)
             {
-                _aiters[i] = _input->getConstIterator(_input->getArrayDesc().getAttributes(true).size()); //empty tag
+                _aiters[i] = input->getConstIterator(i);
             }
-            else if( MODE==READ_INPUT)
+            else if(i == _numAttributesRead)
             {
-                _aiters[i] = _input->getConstIterator(_settings.getInputAttributesRead()[i]);
+                _aiters[i] = _input->getConstIterator(_input->getArrayDesc().getAttributes(true).size()); //empty tag
             }
             else
             {
-                _aiters[i] = input->getConstIterator(i);
+                _aiters[i] = _input->getConstIterator(_settings.getInputAttributesRead()[i]);
             }
         }
         if(MODE == READ_INPUT)
@@ -110,76 +190,258 @@ public:
         }
     }
 
+    ~ArrayReader()
+    {
+        reportTuples();
+    }
+
 private:
-    bool setAndCheckTuple()
+    //Charge the tuples made since the last call to the scan, and let the governor see their size
+    void reportTuples()
     {
-        if(MODE==READ_TUPLED)
+        if(_tuplesMade)
         {
-            _tupleOutput = &(_citers[0]->getItem());
-            return true;
+            _settings.getStats().add(PHASE_SCAN, _tuplesMade, _tupleBytes, 0);
+            if(_governor)
+            {
+                _governor->observeTuples(_tuplesMade, _tupleBytes);
+            }
+            _tuplesMade = 0;
+            _tupleBytes = 0;
         }
-        for(size_t i =0; i<_settings.getNumInputAttributesRead(); ++i)
+    }
+
+    /**
+     * Drain the cells of the block from iterator i: the lead records the input positions and sets _blockSize (up
+     * to INPUT_BLOCK_SIZE), the other attributes that become dimensions must line up with it.
+     */
+    void decodeColumn(size_t const i)
+    {
+        ConstChunkIterator& citer = *_citers[i];
+        size_t const nInputDims = _settings.getNumInputDims();
+        bool const lead = (i == _leadIterator);
+        size_t const limit = lead ? INPUT_BLOCK_SIZE : _blockSize;
+        InputColumn* col = i < _numAttributesRead ? &_columns[i] : NULL;
+        if(col)
         {
-            Value const* item = &(_citers[i]->getItem());
-            if(_settings.getInputAttributeFilterNull()[i] && item->isNull())
+            col->missing.clear();
+            col->coords.clear();
+        }
+        size_t n = 0;
+        for( ; n < limit && !citer.end(); ++n, ++citer)
+        {
+            if(lead)
             {
-                return false;
+                Coordinates const& pos = citer.getPosition();
+                _blockPositions.insert(_blockPositions.end(), pos.begin(), pos.begin() + nInputDims);
             }
-            size_t idx = _settings.getInputAttributeDestinations()[i];
-            if(idx < _settings.getNumOutputAttrs())
+            if(col == NULL)
             {
-                _tupleInputs[idx] = item;
+                continue;
             }
-            else
+            Value const& item = citer.getItem();
+            col->missing.push_back(item.isNull() ? item.getMissingReason() : -1);
+            col->coords.push_back(item.isNull() ? 0 : item.getInt64());
+        }
+        _iteratorRows[i] += n;
+        if(lead)
+        {
+            _blockSize = n;
+        }
+        else if(n != _blockSize)
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "input attribute chunks are not aligned";
+        }
+    }
+
+    /**
+     * Compute validity, output chunk, instance and cell position for every cell of the block.
+     */
+    void mapBlock()
+    {
+        size_t const nOutAttrs  = _settings.getNumOutputAttrs();
+        size_t const nOutDims   = _settings.getNumOutputDims();
+        size_t const nInputDims = _settings.getNumInputDims();
+        _blockValid.assign(_blockSize, 1);
+        _blockChunkCoords.resize(_blockSize * nOutDims);
+        _blockInstanceIds.resize(_blockSize);
+        _blockCellPositions.resize(_blockSize);
+        for(size_t i =0; i<_numAttributesRead; ++i)
+        {
+            if(_settings.getInputAttributeFilterNull()[i])
             {
-                _cellCoords[idx - _settings.getNumOutputAttrs()] = item->getInt64();
+                vector<int8_t> const& missing = _columns[i].missing;
+                for(size_t r =0; r<_blockSize; ++r)
+                {
+                    _blockValid[r] &= (missing[r] < 0);
+                }
             }
         }
-        Coordinates const& pos = _citers[0]->getPosition();
-        for(size_t i =0; i<_settings.getNumInputDimensionsRead(); ++i)
+        for(size_t r =0; r<_blockSize; ++r)
         {
-            Coordinate coord = pos[_settings.getInputDimensionsRead()[i]];
-            size_t idx = _settings.getInputDimensionDestinations()[i];
-            if(idx < _settings.getNumOutputAttrs())
+            if(!_blockValid[r])
             {
-                _inputDimensionVals[i].setInt64(coord);
-                _tupleInputs[idx] = &_inputDimensionVals[i];
+                continue;
             }
-            else
+            for(size_t i =0; i<_numAttributesRead; ++i)
+            {
+                if(_isCoordinateColumn[i])
+                {
+                    _cellCoords[_settings.getInputAttributeDestinations()[i] - nOutAttrs] = _columns[i].coords[r];
+                }
+            }
+            Coordinate const* pos = &_blockPositions[r * nInputDims];
+            for(size_t i =0; i<_settings.getNumInputDimensionsRead(); ++i)
+            {
+                size_t idx = _settings.getInputDimensionDestinations()[i];
+                if(idx >= nOutAttrs)
+                {
+                    _cellCoords[idx - nOutAttrs] = pos[_settings.getInputDimensionsRead()[i]];
+                }
+            }
+            _chunkCoords = _cellCoords;
+            _settings.getOutputChunkPosition(_chunkCoords);
+            if(_lastChunkCoords != _chunkCoords)
             {
-                _cellCoords[idx - _settings.getNumOutputAttrs()] = coord;
+                _lastChunkCoords = _chunkCoords;
+                _lastInstanceId = _settings.getInstanceForChunk(_chunkCoords);
             }
+            _blockInstanceIds[r] = _lastInstanceId;
+            _blockCellPositions[r] = _settings.getOutputCellPos(_chunkCoords, _cellCoords);
+            std::copy(_chunkCoords.begin(), _chunkCoords.end(), _blockChunkCoords.begin() + r * nOutDims);
         }
-        _chunkCoords = _cellCoords;
-        _settings.getOutputChunkPosition(_chunkCoords);
-        _dstInstanceId = _settings.getInstanceForChunk(_chunkCoords);
-        _cellLPos = _settings.getOutputCellPos(_chunkCoords, _cellCoords);
-        RedimTuple::makeRedimTuple(_settings.getNumOutputDims(),
-                                   _settings.getNumOutputAttrs(),
+    }
+
+    /**
+     * Decode the next block of the current chunks. Returns false if the chunks are exhausted.
+     */
+    bool loadBlock()
+    {
+        PhaseTimer timer(_settings.getStats(), PHASE_SCAN);
+        reportTuples();
+        _blockStart += _blockSize;
+        _blockRow = 0;
+        _blockPositions.clear();
+        decodeColumn(_leadIterator);
+        if(_blockSize == 0)
+        {
+            return false;
+        }
+        for(size_t i =0; i<_numAttributesRead; ++i)
+        {
+            if(_isCoordinateColumn[i] && i != _leadIterator)
+            {
+                decodeColumn(i);
+            }
+        }
+        mapBlock();
+        return true;
+    }
+
+    //Step the trailing iterator of attribute i to the row of block cell r and view its item in place
+    void viewItem(size_t const i, size_t const r)
+    {
+        ConstChunkIterator& citer = *_citers[i];
+        size_t const row = _blockStart + r;
+        for( ; _iteratorRows[i] < row && !citer.end(); ++_iteratorRows[i])
+        {
+            ++citer;
+        }
+        if(citer.end())
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "input attribute chunks are not aligned";
+        }
+        Value const& item = citer.getItem();
+        AttributeView& view = _itemViews[i];
+        view.missingReason = item.isNull() ? item.getMissingReason() : -1;
+        view.data = static_cast<char const*>(item.data());
+        view.size = item.isNull() ? 0 : item.size();
+    }
+
+    void makeTuple(size_t const r)
+    {
+        size_t const nOutAttrs  = _settings.getNumOutputAttrs();
+        size_t const nOutDims   = _settings.getNumOutputDims();
+        for(size_t i =0; i<_numAttributesRead; ++i)
+        {
+            if(_isCoordinateColumn[i])
+            {
+                continue;
+            }
+            viewItem(i, r);
+            size_t idx = _settings.getInputAttributeDestinations()[i];
+            if(idx < nOutAttrs)
+            {
+                _tupleInputs[idx] = _itemViews[i];
+            }
+        }
+        Coordinate const* pos = &_blockPositions[r * _settings.getNumInputDims()];
+        for(size_t i =0; i<_settings.getNumInputDimensionsRead(); ++i)
+        {
+            size_t idx = _settings.getInputDimensionDestinations()[i];
+            if(idx < nOutAttrs)
+            {
+                _inputDimensionVals[i] = pos[_settings.getInputDimensionsRead()[i]];
+                AttributeView& view = _tupleInputs[idx];
+                view.data = reinterpret_cast<char const*>(&_inputDimensionVals[i]);
+                view.size = sizeof(int64_t);
+                view.missingReason = -1;
+            }
+        }
+        vector<AggregateSpec> const& aggregates = _settings.getAggregates();
+        for(size_t k=0; k<aggregates.size(); ++k)
+        {
+            AggregateSpec const& a = aggregates[k];
+            AttributeView& view = _tupleInputs[a.outputAttr];
+            view.data = &_aggregateStates[k * 2 * sizeof(uint64_t)];
+            view.size = Settings::getAggregateStateSize(a.function);
+            view.missingReason = -1;
+            Aggregates::init(a, a.inputColumn != Settings::NO_INPUT_COLUMN ? &_itemViews[a.inputColumn] : NULL, &_aggregateStates[k * 2 * sizeof(uint64_t)]);
+        }
+        std::copy(_blockChunkCoords.begin() + r * nOutDims, _blockChunkCoords.begin() + (r+1) * nOutDims, _chunkCoords.begin());
+        RedimTuple::makeRedimTuple(nOutDims,
+                                   nOutAttrs,
                                    _settings.outputAttributeNullable(),
                                    _settings.getOutputAttributeSizes(),
-                                   _dstInstanceId,
+                                   _blockInstanceIds[r],
                                    _chunkCoords,
-                                   _cellLPos,
+                                   _blockCellPositions[r],
                                    _tupleInputs,
                                    &_tupleValue);
-        return true; //we got a valid tuple!
+        ++_tuplesMade;
+        _tupleBytes += _tupleValue.size();
     }
 
+    /**
+     * Position on the next valid cell at or after _blockRow, decoding further blocks of the current chunks as
+     * needed. Returns false if the chunks have no more valid cells.
+     */
     bool findNextTupleInChunk()
     {
-        while(!_citers[0]->end())
+        if(MODE==READ_TUPLED)
         {
-            if(setAndCheckTuple())
+            if(_citers[0]->end())
             {
-                return true;
+                return false;
             }
-            for(size_t i =0; i<_numIterators; ++i)
+            _tupleOutput = &(_citers[0]->getItem());
+            return true;
+        }
+        while(true)
+        {
+            for( ; _blockRow < _blockSize; ++_blockRow)
+            {
+                if(_blockValid[_blockRow])
+                {
+                    makeTuple(_blockRow);
+                    return true; //we got a valid tuple!
+                }
+            }
+            if(!loadBlock())
             {
-                ++(*_citers[i]);
+                return false;
             }
         }
-        return false;
     }
 
 public:
@@ -192,9 +454,13 @@ public:
         }
         if(!FIRST_ITERATION)
         {
-            for(size_t i =0; i<_numIterators; ++i)
+            if(MODE==READ_TUPLED)
             {
-                ++(*_citers[i]);
+                ++(*_citers[0]);
+            }
+            else
+            {
+                ++_blockRow;
             }
             if(findNextTupleInChunk())
             {
@@ -211,6 +477,14 @@ public:
             {
                 _citers[i] = _aiters[i]->getChunk().getConstIterator();
             }
+            if(MODE == READ_INPUT)
+            {
+                _settings.getStats().add(PHASE_SCAN, 0, 0, 1);
+            }
+            std::fill(_iteratorRows.begin(), _iteratorRows.end(), 0);
+            _blockStart = 0;
+            _blockSize = 0;
+            _blockRow = 0;
             if(findNextTupleInChunk())
             {
                 return;
@@ -235,23 +509,42 @@ public:
         }
         return _tupleOutput;
     }
+
+    char const* getKey() const
+    {
+        return reinterpret_cast<char const*>(getTuple()->data());
+    }
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 /*
- * Writes out the output array
+ * Writes out the output array. Cells arrive in (chunk, position) order. By default each cell goes straight into the
+ * chunk iterators of the current output chunk, one per attribute, and nothing is held back. Cells are staged instead
+ * when they cannot be written as they come: with a synthetic dimension that is not last, with on_collision=last or
+ * aggregate=..., which revisit the previous cell, and with output_writer=rle or output_threads=N, which write whole
+ * chunks. The cells of the current output chunk are then staged one column per attribute, and when the chunk is
+ * complete each attribute chunk is written out in turn from its column, so only one chunk iterator is hot at a time.
+ * With a synthetic dimension that is not last the staged cells are put in position order first: the positions are
+ * unique and nearly dense within a chunk, so this is a counting sort through a slot per position, falling back to
+ * std::sort when the positions are spread too thin. The staging vectors keep their capacity from chunk to chunk;
+ * their high water mark is logged by finalize, and what they hold is reserved with the MemoryGovernor.
+ * With output_threads=N the attribute chunks are split into N shards (attribute i goes to shard i % N) and written
+ * by N worker threads started with the writer and kept for its lifetime. The merge goes on staging the next chunk
+ * meanwhile; it only waits when that one is complete too. That takes a second set of staging columns, which is
+ * counted with the first.
+ * Writers may run on threads SciDB did not start, and several may share one output array (see parallelGlobalMerge).
+ * Each writer has its own array iterators, and each chunk is filled by one thread only, but MemArray makes no promise
+ * about creating or writing back chunks concurrently: newChunk, and flush or write of a finished chunk, take the
+ * chunk mutex, which is shared by all the writers of one output array.
  */
 class OutputWriter : public boost::noncopyable
 {
 private:
     shared_ptr<Array>                   _output;
-    InstanceID const                    _myInstanceId;
-    size_t const                        _numInstances;
     size_t const                        _numAttributes;
     size_t const                        _numTupleDimensions;
-    size_t const                        _chunkSize;
     shared_ptr<Query>                   _query;
     Settings const&                     _settings;
     Coordinates                         _outputChunkPosition;
@@ -259,9 +552,6 @@ private:
     Coordinates                         _outputChunkPositionBuf;
     Coordinates                         _outputPositionBuf;
     vector<shared_ptr<ArrayIterator> >  _arrayIterators;
-    vector<shared_ptr<ChunkIterator> >  _chunkIterators;
-    size_t                              _currentDstInstanceId;
-    vector<Value>                       _outputValues;
     bool const                          _haveSynthetic;
     size_t                              _syntheticId;
     bool const                          _syntheticLast;
@@ -269,17 +559,95 @@ private:
     Coordinate const                    _syntheticMax;
     Coordinate                          _currSynthetic;
     Value                               _boolTrue;
-    CoordinatesLess                     _coordComparator;
-    vector<Value>                       _redimTupleBuf;
+
+    struct StagedChunk
+    {
+        Coordinates                     position;
+        vector<position_t>              positions;
+        vector<Coordinate>              coords;   //_numTupleDimensions per cell
+        vector<vector<char> >           data;     //per attribute: the values back to back
+        vector<vector<size_t> >         offsets;  //per attribute: where each cell's value starts in data
+        vector<vector<int8_t> >         missing;  //per attribute: missing reason, -1 if present
+        vector<size_t>                  order;    //cells in position order
+
+        explicit StagedChunk(size_t const numAttributes):
+            data    (numAttributes),
+            offsets (numAttributes),
+            missing (numAttributes)
+        {}
+
+        size_t getBytes() const
+        {
+            size_t result = positions.capacity() * sizeof(position_t) + coords.capacity() * sizeof(Coordinate) + order.capacity() * sizeof(size_t);
+            for(size_t i=0; i<data.size(); ++i)
+            {
+                result += data[i].capacity() + offsets[i].capacity() * sizeof(size_t) + missing[i].capacity();
+            }
+            return result;
+        }
+
+        size_t getSize(size_t const attr, size_t const cell) const
+        {
+            return (cell + 1 < offsets[attr].size() ? offsets[attr][cell+1] : data[attr].size()) - offsets[attr][cell];
+        }
+
+        void clear()
+        {
+            positions.clear();
+            coords.clear();
+            for(size_t i=0; i<data.size(); ++i)
+            {
+                data[i].clear();
+                offsets[i].clear();
+                missing[i].clear();
+            }
+            order.clear();
+        }
+    };
+
+    StagedChunk                         _staged;
+    StagedChunk                         _flushing;       //being written by the output threads
+    vector<size_t>                      _slots;          //counting sort: staged cell at each position, or NO_CELL
+    size_t                              _stagedHighWater;
+    MemoryReservation                   _memory;
+    size_t                              _numCellsWritten;
+    CollisionPolicy const               _onCollision;
+    size_t                              _numCollisions;
+    bool const                          _haveAggregates;
+    vector<char>                        _aggregateBuf;
+    size_t const                        _numWriteThreads;
+    bool const                          _directRle;
+    vector<size_t>                      _attributeSizes; //0 if variable size
+    vector<bool>                        _attributeIsBool;
+    bool const                          _staging;
+    vector<shared_ptr<ChunkIterator> >  _chunkIterators; //without staging: the current output chunk
+    Value                               _value;
+    size_t                              _directCells;
+    size_t                              _directBytes;
+    shared_ptr<std::mutex>              _chunkMutex;     //shared by the writers of _output
+    vector<std::thread>                 _workers;        //output_threads > 1: one per shard
+    std::mutex                          _workMutex;
+    std::condition_variable             _workReady;
+    std::condition_variable             _workDone;
+    size_t                              _workGeneration; //bumped for every chunk handed to the workers
+    size_t                              _shardsPending;
+    bool                                _stopWorkers;
+    std::exception_ptr                  _workError;
 
 public:
-    OutputWriter(Settings const& settings, shared_ptr<Query> const& query):
-        _output               (std::make_shared<MemArray>(settings.getOutputSchema(), query)),
-        _myInstanceId         (query->getInstanceID()),
-        _numInstances         (query->getInstancesCount()),
+    OutputWriter(Settings const& settings, shared_ptr<Query> const& query, MemoryGovernor& governor):
+        OutputWriter(settings, query, std::make_shared<MemArray>(settings.getOutputSchema(), query), std::make_shared<std::mutex>(), governor)
+    {}
+
+    /*
+     * Write into an output array shared with other writers, as the parallel merge does. Every writer must be given
+     * different output chunks, and the same chunkMutex.
+     */
+    OutputWriter(Settings const& settings, shared_ptr<Query> const& query, shared_ptr<Array> const& output,
+                 shared_ptr<std::mutex> const& chunkMutex, MemoryGovernor& governor):
+        _output               (output),
         _numAttributes        (_output->getArrayDesc().getAttributes(true).size()),
         _numTupleDimensions   (settings.getNumOutputDims()),
-        _chunkSize            (settings.getSortedArrayChunkSize()),
         _query                (query),
         _settings             (settings),
         _outputChunkPosition     ( 0),
@@ -287,96 +655,566 @@ public:
         _outputChunkPositionBuf  (_output->getArrayDesc().getDimensions().size(), 0),
         _outputPositionBuf       (_output->getArrayDesc().getDimensions().size(), 0),
         _arrayIterators       (_numAttributes+1, NULL),
-        _chunkIterators       (_numAttributes+1, NULL),
-        _outputValues         (_settings.getNumOutputAttrs()),
         _haveSynthetic        (_settings.haveSynthetic()),
         _syntheticId          (_settings.getSyntheticId()),
         _syntheticLast        (_haveSynthetic && _syntheticId == _numTupleDimensions-1),
         _syntheticMin         (_settings.getSyntheticMin()),
         _syntheticMax         (_settings.getSyntheticMax()),
-        _currSynthetic        (_syntheticMin)
+        _currSynthetic        (_syntheticMin),
+        _staged               (_numAttributes),
+        _flushing             (_numAttributes),
+        _stagedHighWater      (0),
+        _memory               (&governor),
+        _numCellsWritten      (0),
+        _onCollision          (_settings.getCollisionPolicy()),
+        _numCollisions        (0),
+        _haveAggregates       (_settings.haveAggregates()),
+        _numWriteThreads      (std::min(_settings.getOutputThreads(), _numAttributes+1)),
+        _directRle            (_settings.getOutputWriter() == OUTPUT_WRITER_RLE),
+        _attributeSizes       (_numAttributes),
+        _attributeIsBool      (_numAttributes),
+        _staging              (_directRle || _numWriteThreads > 1 || (_haveSynthetic && !_syntheticLast) ||
+                               _onCollision == COLLISION_LAST || _haveAggregates),
+        _chunkIterators       (_numAttributes+1),
+        _directCells          (0),
+        _directBytes          (0),
+        _chunkMutex           (chunkMutex),
+        _workGeneration       (0),
+        _shardsPending        (0),
+        _stopWorkers          (false)
     {
         _boolTrue.setBool(true);
+        Attributes const& attributes = _output->getArrayDesc().getAttributes(true);
         for(size_t i =0; i<_numAttributes+1; ++i)
         {
             _arrayIterators[i] = _output->getIterator(i);
+            if(i < _numAttributes)
+            {
+                _attributeSizes[i]  = attributes[i].getSize();
+                _attributeIsBool[i] = attributes[i].getType() == TID_BOOL;
+            }
         }
-        if(!_syntheticLast)
+        for(size_t i=0; _numWriteThreads > 1 && i<_numWriteThreads; ++i)
         {
-            _redimTupleBuf.reserve(1024*1024);
+            _workers.push_back(std::thread(&OutputWriter::workerLoop, this, i));
+        }
+    }
+
+    ~OutputWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_workMutex);
+            _stopWorkers = true;
+        }
+        _workReady.notify_all();
+        for(size_t i=0; i<_workers.size(); ++i)
+        {
+            _workers[i].join();
         }
     }
 
 private:
-    void flushTuplesFromBuffer()
+    void stageCell(position_t const cellPos, vector<AttributeView> const& values)
     {
-        size_t const nTuples = _redimTupleBuf.size();
-        vector<Value*> redimTuplePtrBuf(nTuples);
-        redimTuplePtrBuf[0] = &_redimTupleBuf[0];
-        for(size_t i=1; i<nTuples;++i)
+        _staged.positions.push_back(cellPos);
+        _staged.coords.insert(_staged.coords.end(), _outputPosition.begin(), _outputPosition.end());
+        for(size_t i=0; i<_numAttributes; ++i)
         {
-            redimTuplePtrBuf[i] = redimTuplePtrBuf[i-1]+1;
+            AttributeView const& v = values[i];
+            vector<char>& data = _staged.data[i];
+            _staged.offsets[i].push_back(data.size());
+            _staged.missing[i].push_back(v.missingReason);
+            if(v.missingReason < 0)
+            {
+                data.insert(data.end(), v.data, v.data + v.size);
+            }
         }
-        RedimTupleComparator comparator;
-        std::sort(redimTuplePtrBuf.begin(), redimTuplePtrBuf.end(), comparator);
-        uint32_t dstInstanceId;
-        position_t cellPos;
-        Coordinates outputCellPos(_numTupleDimensions);
-        vector<Value> outputValues (_settings.getNumOutputAttrs());
-        for(size_t i=0; i<nTuples; ++i)
+    }
+
+    //Without staging: write the cell at _outputPosition, opening the chunk iterators if it is the first of its chunk
+    void writeDirect(vector<AttributeView> const& values)
+    {
+        if(_chunkIterators[0].get() == NULL)
+        {
+            for(size_t i=0; i<_numAttributes+1; ++i)
+            {
+                _chunkIterators[i] = newChunkIterator(i, _outputChunkPosition);
+            }
+        }
+        for(size_t i=0; i<_numAttributes; ++i)
+        {
+            AttributeView const& v = values[i];
+            if(v.missingReason >= 0)
+            {
+                _value.setNull(v.missingReason);
+            }
+            else
+            {
+                _value.setData(v.data, v.size);
+                _directBytes += v.size;
+            }
+            _chunkIterators[i]->setPosition(_outputPosition);
+            _chunkIterators[i]->writeItem(_value);
+        }
+        _chunkIterators[_numAttributes]->setPosition(_outputPosition);
+        _chunkIterators[_numAttributes]->writeItem(_boolTrue);
+        ++_directCells;
+    }
+
+    void flushDirectChunk()
+    {
+        if(_chunkIterators[0].get() == NULL)
+        {
+            return;
+        }
+        PhaseTimer timer(_settings.getStats(), PHASE_WRITE);
+        for(size_t i=0; i<_numAttributes+1; ++i)
+        {
+            flushChunkIterator(*_chunkIterators[i]);
+            _chunkIterators[i].reset();
+        }
+        _settings.getStats().add(PHASE_WRITE, _directCells, _directBytes, 1);
+        _directCells = 0;
+        _directBytes = 0;
+    }
+
+    void flushChunk()
+    {
+        if(_staging)
+        {
+            flushStagedChunk();
+        }
+        else
         {
-            Value const* tuple = redimTuplePtrBuf[i];
-            RedimTuple::decomposeTuple(_settings.getNumOutputDims(),
-                                       _settings.getNumOutputAttrs(),
-                                       _settings.outputAttributeNullable(),
-                                       _settings.getOutputAttributeSizes(),
-                                       tuple,
-                                       dstInstanceId,
-                                       outputCellPos,
-                                       cellPos,
-                                       outputValues);
-            _settings.getOutputCellCoords(_outputChunkPosition, cellPos, outputCellPos);
-            for(size_t i=0; i<_numAttributes; ++i)
+            flushDirectChunk();
+        }
+    }
+
+    //aggregate=...: fold the states of a colliding cell into the cell staged last; the other attributes keep the first value
+    void combineIntoLastCell(vector<AttributeView> const& values)
+    {
+        vector<AggregateSpec> const& aggregates = _settings.getAggregates();
+        for(size_t k=0; k<aggregates.size(); ++k)
+        {
+            size_t const o = aggregates[k].outputAttr;
+            Aggregates::combine(aggregates[k], &_staged.data[o][_staged.offsets[o].back()], values[o].data);
+        }
+    }
+
+    //aggregate=...: replace the state columns of the staged chunk with the output values
+    void finalizeAggregates()
+    {
+        vector<AggregateSpec> const& aggregates = _settings.getAggregates();
+        size_t const nCells = _staged.positions.size();
+        for(size_t k=0; k<aggregates.size(); ++k)
+        {
+            size_t const o = aggregates[k].outputAttr;
+            _aggregateBuf.clear();
+            for(size_t i=0; i<nCells; ++i)
+            {
+                size_t const offset = _aggregateBuf.size();
+                _staged.missing[o][i] = Aggregates::finalize(aggregates[k], &_staged.data[o][_staged.offsets[o][i]], _aggregateBuf);
+                _staged.offsets[o][i] = offset;
+            }
+            _staged.data[o].swap(_aggregateBuf);
+        }
+    }
+
+    //on_collision=last: the cell staged last gives way to the one that collided with it
+    void unstageLastCell()
+    {
+        _staged.positions.pop_back();
+        _staged.coords.resize(_staged.coords.size() - _outputPosition.size());
+        for(size_t i=0; i<_numAttributes; ++i)
+        {
+            _staged.data[i].resize(_staged.offsets[i].back());
+            _staged.offsets[i].pop_back();
+            _staged.missing[i].pop_back();
+        }
+    }
+
+    void flushStagedChunk()
+    {
+        size_t const nCells = _staged.positions.size();
+        if(nCells == 0)
+        {
+            return;
+        }
+        _staged.position = _outputChunkPosition;
+        if(_haveAggregates)
+        {
+            finalizeAggregates();
+        }
+        vector<size_t>& order = _staged.order;
+        order.resize(nCells);
+        for(size_t i=0; i<nCells; ++i)
+        {
+            order[i] = i;
+        }
+        if(_haveSynthetic && !_syntheticLast)
+        {
+            sortStagedByPosition();
+        }
+        size_t const stagingBytes = _staged.getBytes() + _flushing.getBytes() + _slots.capacity() * sizeof(size_t);
+        _stagedHighWater = std::max(_stagedHighWater, stagingBytes);
+        _memory.update(stagingBytes);
+        size_t stagedBytes = 0;
+        for(size_t i=0; i<_numAttributes; ++i)
+        {
+            stagedBytes += _staged.data[i].size();
+        }
+        _settings.getStats().add(PHASE_WRITE, nCells, stagedBytes, 1);
+        if(_numWriteThreads <= 1)
+        {
+            writeShard(_staged, 0, 1, false);
+            _staged.clear();
+            return;
+        }
+        waitForFlush();
+        std::swap(_staged, _flushing);
+        _staged.clear();
+        {
+            std::lock_guard<std::mutex> lock(_workMutex);
+            _shardsPending = _numWriteThreads;
+            ++_workGeneration;
+        }
+        _workReady.notify_all();
+    }
+
+    void sortStagedByPosition()
+    {
+        size_t const COUNTING_SORT_MAX_SPREAD = 8; //slots per staged cell
+        size_t const NO_CELL = SIZE_MAX;
+        vector<position_t> const& positions = _staged.positions;
+        vector<size_t>& order = _staged.order;
+        size_t const nCells = positions.size();
+        position_t const minPos = *std::min_element(positions.begin(), positions.end());
+        position_t const maxPos = *std::max_element(positions.begin(), positions.end());
+        size_t const spread = maxPos - minPos + 1;
+        if(spread > COUNTING_SORT_MAX_SPREAD * nCells)
+        {
+            std::sort(order.begin(), order.end(), [&positions](size_t const a, size_t const b) { return positions[a] < positions[b]; });
+            return;
+        }
+        _slots.assign(spread, NO_CELL);
+        for(size_t i=0; i<nCells; ++i)
+        {
+            size_t& slot = _slots[positions[i] - minPos];
+            if(slot != NO_CELL)
+            {
+                throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "[defensive] two staged cells at one position";
+            }
+            slot = i;
+        }
+        order.clear();
+        for(size_t j=0; j<spread; ++j)
+        {
+            if(_slots[j] != NO_CELL)
             {
-                _chunkIterators[i]->setPosition(outputCellPos);
-                _chunkIterators[i]->writeItem(outputValues[i]);
+                order.push_back(_slots[j]);
             }
-            _chunkIterators[_numAttributes]->setPosition(outputCellPos);
-            _chunkIterators[_numAttributes]->writeItem(_boolTrue);
         }
-        _redimTupleBuf.clear();
     }
 
+    //Wait for the workers to be done with _flushing; an error on any of them is thrown here
+    void waitForFlush()
+    {
+        std::unique_lock<std::mutex> lock(_workMutex);
+        _workDone.wait(lock, [this] () { return _shardsPending == 0; });
+        if(_workError)
+        {
+            std::exception_ptr const error = _workError;
+            _workError = std::exception_ptr();
+            std::rethrow_exception(error);
+        }
+    }
+
+    //Output worker: write shard `shard` of every chunk handed over in _flushing
+    void workerLoop(size_t const shard)
+    {
+        size_t generation = 0;
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_workMutex);
+                _workReady.wait(lock, [this, generation] () { return _stopWorkers || _workGeneration != generation; });
+                if(_stopWorkers)
+                {
+                    return;
+                }
+                generation = _workGeneration;
+            }
+            std::exception_ptr error;
+            try
+            {
+                writeShard(_flushing, shard, _numWriteThreads, true);
+            }
+            catch(...)
+            {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(_workMutex);
+            if(error && !_workError)
+            {
+                _workError = error;
+            }
+            if(--_shardsPending == 0)
+            {
+                _workDone.notify_all();
+            }
+        }
+    }
+
+    Chunk& newOutputChunk(size_t const attr, Coordinates const& position)
+    {
+        std::lock_guard<std::mutex> lock(*_chunkMutex);
+        return _arrayIterators[attr]->newChunk(position);
+    }
+
+    void writeOutputChunk(Chunk& chunk)
+    {
+        std::lock_guard<std::mutex> lock(*_chunkMutex);
+        chunk.write(_query);
+    }
+
+    shared_ptr<ChunkIterator> newChunkIterator(size_t const attr, Coordinates const& position)
+    {
+        std::lock_guard<std::mutex> lock(*_chunkMutex);
+        return _arrayIterators[attr]->newChunk(position).getIterator(_query, ChunkIterator::SEQUENTIAL_WRITE | ChunkIterator::NO_EMPTY_CHECK );
+    }
+
+    void flushChunkIterator(ChunkIterator& chunkIter)
+    {
+        std::lock_guard<std::mutex> lock(*_chunkMutex);
+        chunkIter.flush();
+    }
+
+    //Write attributes first, first+step, ... of the chunk; the empty tag is attribute _numAttributes
+    void writeShard(StagedChunk const& chunk, size_t const first, size_t const step, bool const helperThread)
+    {
+        PhaseTimer timer(_settings.getStats(), PHASE_WRITE, helperThread);
+        for(size_t i=first; i<_numAttributes+1; i+=step)
+        {
+            if(!_directRle)
+            {
+                writeThroughIterator(chunk, i);
+            }
+            else if(i == _numAttributes)
+            {
+                writeEmptyBitmapChunk(chunk);
+            }
+            else
+            {
+                writePayloadChunk(chunk, i);
+            }
+        }
+    }
+
+    void writeThroughIterator(StagedChunk const& chunk, size_t const attr)
+    {
+        vector<size_t> const& order = chunk.order;
+        size_t const nCells = order.size();
+        Coordinates cellCoords(_numTupleDimensions);
+        Value value;
+        shared_ptr<ChunkIterator> chunkIter = newChunkIterator(attr, chunk.position);
+        for(size_t j=0; j<nCells; ++j)
+        {
+            size_t const cell = order[j];
+            std::copy(chunk.coords.begin() + cell * _numTupleDimensions,
+                      chunk.coords.begin() + (cell+1) * _numTupleDimensions,
+                      cellCoords.begin());
+            chunkIter->setPosition(cellCoords);
+            if(attr == _numAttributes)
+            {
+                chunkIter->writeItem(_boolTrue);
+                continue;
+            }
+            int8_t const missingReason = chunk.missing[attr][cell];
+            if(missingReason >= 0)
+            {
+                value.setNull(missingReason);
+            }
+            else
+            {
+                value.setData(chunk.data[attr].data() + chunk.offsets[attr][cell], chunk.getSize(attr, cell));
+            }
+            chunkIter->writeItem(value);
+        }
+        flushChunkIterator(*chunkIter);
+    }
+
+    /*
+     * Write attribute attr of the staged chunk as a ConstRLEPayload - the same layout initSgChunk writes for a single
+     * blob. The cells are non-empty by construction, so the payload is dense over [0, nCells): a new segment starts
+     * only where a run of values meets a run of nulls (or a null with another missing reason). Then come the values:
+     * fixed size ones back to back, booleans as bits, variable size ones as an offset table followed by the items,
+     * each prefixed by [uint8 size] or, if it does not fit in 1..255, by [0][uint32 size].
+     */
+    void writePayloadChunk(StagedChunk const& chunk, size_t const attr)
+    {
+        vector<size_t> const& order = chunk.order;
+        size_t const nCells = order.size();
+        vector<int8_t> const& missing = chunk.missing[attr];
+        size_t const elemSize = _attributeSizes[attr];
+        bool const isBoolean = _attributeIsBool[attr];
+        size_t nSegs = 0;
+        size_t nValues = 0;
+        size_t varSize = 0;
+        int prevReason = -2; //neither a missing reason nor present
+        for(size_t j=0; j<nCells; ++j)
+        {
+            size_t const cell = order[j];
+            int8_t const reason = missing[cell];
+            if(reason >= 0 ? reason != prevReason : prevReason != -1)
+            {
+                ++nSegs;
+            }
+            prevReason = reason;
+            if(reason < 0)
+            {
+                ++nValues;
+                if(elemSize == 0)
+                {
+                    size_t const size = chunk.getSize(attr, cell);
+                    varSize += (size >= 1 && size <= 255 ? 1 : 5) + size;
+                }
+            }
+        }
+        size_t const varOffs  = elemSize == 0 ? nValues * sizeof(varpart_offset_t) : 0;
+        size_t const dataSize = isBoolean     ? (nValues + 7) / 8 :
+                                elemSize != 0 ? nValues * elemSize :
+                                                varOffs + varSize;
+        Chunk& outputChunk = newOutputChunk(attr, chunk.position);
+        outputChunk.allocate(sizeof(ConstRLEPayload::Header) + (nSegs + 1) * sizeof(ConstRLEPayload::Segment) + dataSize);
+        ConstRLEPayload::Header* hdr = (ConstRLEPayload::Header*) outputChunk.getData();
+        hdr->_magic = RLE_PAYLOAD_MAGIC;
+        hdr->_nSegs = nSegs;
+        hdr->_elemSize = elemSize;
+        hdr->_dataSize = dataSize;
+        hdr->_varOffs = varOffs;
+        hdr->_isBoolean = isBoolean;
+        ConstRLEPayload::Segment* seg = (ConstRLEPayload::Segment*) (hdr+1);
+        char* values = reinterpret_cast<char*>(seg + nSegs + 1);
+        if(isBoolean)
+        {
+            memset(values, 0, dataSize);
+        }
+        varpart_offset_t* varOffsets = reinterpret_cast<varpart_offset_t*>(values);
+        char* varPart = values + varOffs;
+        char* item = varPart;
+        vector<char> const& data = chunk.data[attr];
+        size_t valueIndex = 0;
+        prevReason = -2;
+        for(size_t j=0; j<nCells; ++j)
+        {
+            size_t const cell = order[j];
+            int8_t const reason = missing[cell];
+            if(reason >= 0)
+            {
+                if(reason != prevReason)
+                {
+                    *seg++ = ConstRLEPayload::Segment(j, reason, true, true);
+                }
+                prevReason = reason;
+                continue;
+            }
+            if(prevReason != -1)
+            {
+                *seg++ = ConstRLEPayload::Segment(j, valueIndex, false, false);
+            }
+            prevReason = -1;
+            char const* src = data.data() + chunk.offsets[attr][cell];
+            if(isBoolean)
+            {
+                if(*src)
+                {
+                    values[valueIndex >> 3] |= (char) (1 << (valueIndex & 7));
+                }
+            }
+            else if(elemSize != 0)
+            {
+                memcpy(values + valueIndex * elemSize, src, elemSize);
+            }
+            else
+            {
+                size_t const size = chunk.getSize(attr, cell);
+                varOffsets[valueIndex] = (varpart_offset_t) (item - varPart);
+                if(size >= 1 && size <= 255)
+                {
+                    *item++ = (char) size;
+                }
+                else
+                {
+                    *item++ = 0;
+                    uint32_t const size32 = (uint32_t) size;
+                    memcpy(item, &size32, sizeof(uint32_t));
+                    item += sizeof(uint32_t);
+                }
+                memcpy(item, src, size);
+                item += size;
+            }
+            ++valueIndex;
+        }
+        *seg = ConstRLEPayload::Segment(nCells, 0, false, false);
+        writeOutputChunk(outputChunk);
+    }
+
+    //The empty tag chunk: one ConstRLEEmptyBitmap segment per run of consecutive cell positions
+    void writeEmptyBitmapChunk(StagedChunk const& chunk)
+    {
+        vector<size_t> const& order = chunk.order;
+        vector<position_t> const& positions = chunk.positions;
+        size_t const nCells = order.size();
+        size_t nSegs = 0;
+        for(size_t j=0; j<nCells; ++j)
+        {
+            if(j == 0 || positions[order[j]] != positions[order[j-1]] + 1)
+            {
+                ++nSegs;
+            }
+        }
+        Chunk& outputChunk = newOutputChunk(_numAttributes, chunk.position);
+        outputChunk.allocate(sizeof(ConstRLEEmptyBitmap::Header) + nSegs * sizeof(ConstRLEEmptyBitmap::Segment));
+        ConstRLEEmptyBitmap::Header* hdr = (ConstRLEEmptyBitmap::Header*) outputChunk.getData();
+        hdr->_magic = RLE_EMPTY_BITMAP_MAGIC;
+        hdr->_nSegs = nSegs;
+        hdr->_nNonEmptyElements = nCells;
+        ConstRLEEmptyBitmap::Segment* seg = (ConstRLEEmptyBitmap::Segment*) (hdr+1);
+        for(size_t j=0; j<nCells; ++j)
+        {
+            position_t const pos = positions[order[j]];
+            if(j != 0 && pos == positions[order[j-1]] + 1)
+            {
+                ++(seg[-1]._length);
+                continue;
+            }
+            seg->_lPosition = pos;
+            seg->_length = 1;
+            seg->_pPosition = j;
+            ++seg;
+        }
+        writeOutputChunk(outputChunk);
+    }
 
 public:
-    void writeTuple(Value const* tuple)
+    /*
+     * Add one cell. key points at the normalized tuple key (see RedimTuple); key and values are read in place - they
+     * may point into a pinned SG chunk - and only need to stay valid for the duration of the call. values must have
+     * one entry per output attribute; they are copied once, into the chunk iterators or the staged columns.
+     */
+    void writeCell(char const* key, vector<AttributeView> const& values)
     {
-        bool newChunk = false;
-        uint32_t dstInstanceId;
         position_t cellPos;
-        RedimTuple::decomposeTuple(_settings.getNumOutputDims(),
-                                    _settings.getNumOutputAttrs(),
-                                    _settings.outputAttributeNullable(),
-                                    _settings.getOutputAttributeSizes(),
-                                    tuple,
-                                    dstInstanceId,
-                                    _outputChunkPositionBuf,
-                                    cellPos,
-                                    _outputValues);
+        RedimTuple::decodeKey(_numTupleDimensions, key, _outputChunkPositionBuf, cellPos);
         _settings.getOutputCellCoords(_outputChunkPositionBuf, cellPos, _outputPositionBuf);
         if(_outputChunkPosition.size() == 0) //first one!
         {
             _outputChunkPosition = _outputChunkPositionBuf;
-            newChunk = true;
         }
         else if(_outputChunkPositionBuf != _outputChunkPosition)
         {
-            if(_haveSynthetic && !_syntheticLast && _redimTupleBuf.size())
-            {
-                flushTuplesFromBuffer();
-            }
+            flushChunk();
             _outputChunkPosition = _outputChunkPositionBuf;
-            newChunk = true;
         }
         if(_outputPosition.size() == 0)
         {
@@ -414,52 +1252,50 @@ public:
         }
         else if(_outputPositionBuf == _outputPosition)
         {
-            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "Data collision";
+            //the merge delivers tuples in position order, so a colliding cell always follows the one it collides with
+            if(_haveAggregates)
+            {
+                combineIntoLastCell(values);
+                ++_numCollisions;
+                return;
+            }
+            if(_onCollision == COLLISION_ERROR)
+            {
+                throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "Data collision";
+            }
+            ++_numCollisions;
+            if(_onCollision != COLLISION_LAST)
+            {
+                return;
+            }
+            unstageLastCell();
+            --_numCellsWritten;
         }
         _outputPosition = _outputPositionBuf;
-        if( newChunk )
+        if(_haveSynthetic)
         {
-            for(size_t i=0; i<_numAttributes+1; ++i)
-            {
-                if(_chunkIterators[i].get())
-                {
-                    _chunkIterators[i]->flush();
-                }
-                _chunkIterators[i] = _arrayIterators[i]->newChunk(_outputChunkPosition).getIterator(_query, ChunkIterator::SEQUENTIAL_WRITE | ChunkIterator::NO_EMPTY_CHECK );
-            }
+            cellPos = _settings.getOutputCellPos(_outputChunkPosition, _outputPosition);
         }
-        if(_haveSynthetic && !_syntheticLast)
+        if(_staging)
         {
-            _redimTupleBuf.push_back(*tuple);
-            Value* bufTuple = &(_redimTupleBuf[_redimTupleBuf.size()-1]);
-            position_t cellPos = _settings.getOutputCellPos(_outputChunkPosition, _outputPosition);
-            RedimTuple::setTuplePosition(bufTuple, _numTupleDimensions, cellPos);
+            stageCell(cellPos, values);
         }
         else
         {
-            for(size_t i=0; i<_numAttributes; ++i)
-            {
-                _chunkIterators[i]->setPosition(_outputPosition);
-                _chunkIterators[i]->writeItem(_outputValues[i]);
-            }
-            _chunkIterators[_numAttributes]->setPosition(_outputPosition);
-            _chunkIterators[_numAttributes]->writeItem(_boolTrue);
+            writeDirect(values);
         }
+        ++_numCellsWritten;
     }
 
     shared_ptr<Array> finalize()
     {
-        if(_haveSynthetic && !_syntheticLast && _redimTupleBuf.size())
-        {
-            flushTuplesFromBuffer();
-        }
+        flushChunk();
+        waitForFlush();
+        LOG4CXX_DEBUG(logger, "FR output staging high water "<<_stagedHighWater<<" bytes; "<<_numCollisions<<" colliding cells dropped or combined");
+        _settings.getStats().add(PHASE_MERGE, _numCellsWritten, 0, 0);
+        _settings.getStats().notePeakStaging(_stagedHighWater);
         for(size_t  i =0; i<_numAttributes+1; ++i)
         {
-            if(_chunkIterators[i].get())
-            {
-                _chunkIterators[i]->flush();
-            }
-            _chunkIterators[i].reset();
             _arrayIterators[i].reset();
         }
         shared_ptr<Array> result = _output;
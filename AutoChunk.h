@@ -0,0 +1,406 @@
+/*
+**
+* BEGIN_COPYRIGHT
+*
+* Copyright (C) 2008-2016 SciDB, Inc.
+* All Rights Reserved.
+*
+* faster_redimension is a plugin for SciDB, an Open Source Array DBMS maintained
+* by Paradigm4. See http://www.paradigm4.com/
+*
+* faster_redimension is free software: you can redistribute it and/or modify
+* it under the terms of the AFFERO GNU General Public License as published by
+* the Free Software Foundation.
+*
+* faster_redimension is distributed "AS-IS" AND WITHOUT ANY WARRANTY OF ANY KIND,
+* INCLUDING ANY IMPLIED WARRANTY OF MERCHANTABILITY,
+* NON-INFRINGEMENT, OR FITNESS FOR A PARTICULAR PURPOSE. See
+* the AFFERO GNU General Public License for the complete license terms.
+*
+* You should have received a copy of the AFFERO GNU General Public License
+* along with faster_redimension.  If not, see <http://www.gnu.org/licenses/agpl-3.0.html>
+*
+* END_COPYRIGHT
+*/
+
+#ifndef AUTOCHUNK_H_
+#define AUTOCHUNK_H_
+
+#include <math.h>
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <util/Network.h>
+#include "FasterRedimensionSettings.h"
+
+namespace scidb
+{
+namespace faster_redimension
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+ * A distinct count estimate that merges across instances: the K smallest 64-bit hashes seen (K minimum values).
+ * Below K distinct values the count is exact.
+ */
+class DistinctSketch
+{
+private:
+    static size_t const K = 1024;
+    std::set<uint64_t> _hashes;
+
+    static uint64_t hash(int64_t const value)
+    {
+        uint64_t x = static_cast<uint64_t>(value) + 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+
+public:
+    void addHash(uint64_t const h)
+    {
+        if(_hashes.size() == K)
+        {
+            if(h >= *_hashes.rbegin())
+            {
+                return;
+            }
+            if(_hashes.insert(h).second)
+            {
+                _hashes.erase(--_hashes.end());
+            }
+            return;
+        }
+        _hashes.insert(h);
+    }
+
+    void add(int64_t const value)
+    {
+        addHash(hash(value));
+    }
+
+    double estimate() const
+    {
+        if(_hashes.size() < K)
+        {
+            return static_cast<double>(_hashes.size());
+        }
+        return (K - 1) / (static_cast<double>(*_hashes.rbegin()) / 18446744073709551616.0);
+    }
+
+    std::set<uint64_t> const& getHashes() const
+    {
+        return _hashes;
+    }
+};
+
+/*
+ * Picks the chunk intervals of auto-chunked target dimensions ([x=0:*,*,0]) from the data, before the main scan.
+ * Each instance reads the input columns that feed the target dimensions - those only - and keeps, per dimension,
+ * the smallest and largest coordinate and a DistinctSketch, along with the number of cells. The summaries go to every
+ * other instance, so all of them merge the same figures and pick the same intervals:
+ *  - the target wants N / target_cells_per_chunk chunks in all;
+ *  - a dimension with an explicit interval spans min(distinct, range / interval) chunks of those;
+ *  - the rest is shared evenly among the auto-chunked dimensions, except that a dimension is never cut into more
+ *    chunks than it has distinct values; what such a dimension cannot take goes to the others;
+ *  - the interval is the range of the dimension over its share, rounded up.
+ * Cells with a null coordinate are skipped, as the main scan skips them.
+ */
+class AutoChunker : public boost::noncopyable
+{
+private:
+    struct DimensionSummary
+    {
+        int64_t        min;
+        int64_t        max;
+        DistinctSketch distinct;
+
+        DimensionSummary():
+            min(CoordinateBounds::getMax()),
+            max(CoordinateBounds::getMin())
+        {}
+    };
+
+    Settings const&          _settings;
+    size_t const             _numDims;
+    vector<DimensionSummary> _dims;
+    uint64_t                 _numCells;
+    vector<size_t>           _attrSources;     //input attribute feeding each target dimension, or _numInputAttrs
+    vector<size_t>           _dimSources;      //input dimension feeding each target dimension, or _numInputDims
+
+    void merge(vector<uint64_t> const& buf)
+    {
+        size_t i = 0;
+        _numCells += buf[i++];
+        for(size_t d=0; d<_numDims; ++d)
+        {
+            DimensionSummary& s = _dims[d];
+            s.min = std::min(s.min, static_cast<int64_t>(buf[i++]));
+            s.max = std::max(s.max, static_cast<int64_t>(buf[i++]));
+            size_t const numHashes = buf[i++];
+            for(size_t h=0; h<numHashes; ++h)
+            {
+                s.distinct.addHash(buf[i++]);
+            }
+        }
+    }
+
+    //[numCells] then per dimension [min][max][numHashes][hash]...
+    vector<uint64_t> serialize() const
+    {
+        vector<uint64_t> buf(1, _numCells);
+        for(size_t d=0; d<_numDims; ++d)
+        {
+            DimensionSummary const& s = _dims[d];
+            buf.push_back(static_cast<uint64_t>(s.min));
+            buf.push_back(static_cast<uint64_t>(s.max));
+            buf.push_back(s.distinct.getHashes().size());
+            buf.insert(buf.end(), s.distinct.getHashes().begin(), s.distinct.getHashes().end());
+        }
+        return buf;
+    }
+
+public:
+    AutoChunker(Settings const& settings):
+        _settings(settings),
+        _numDims(settings.getNumOutputDims()),
+        _dims(_numDims),
+        _numCells(0),
+        _attrSources(_numDims, settings.getNumInputAttrs()),
+        _dimSources(_numDims, settings.getNumInputDims())
+    {
+        size_t const nOutAttrs = settings.getNumOutputAttrs();
+        for(size_t i=0; i<settings.getNumInputAttributesRead(); ++i)
+        {
+            size_t const idx = settings.getInputAttributeDestinations()[i];
+            if(idx >= nOutAttrs && idx != Settings::AGGREGATE_INPUT_ONLY)
+            {
+                _attrSources[idx - nOutAttrs] = settings.getInputAttributesRead()[i];
+            }
+        }
+        for(size_t i=0; i<settings.getNumInputDimensionsRead(); ++i)
+        {
+            size_t const idx = settings.getInputDimensionDestinations()[i];
+            if(idx >= nOutAttrs)
+            {
+                _dimSources[idx - nOutAttrs] = settings.getInputDimensionsRead()[i];
+            }
+        }
+    }
+
+    static bool isAutochunked(ArrayDesc const& schema)
+    {
+        for(size_t d=0; d<schema.getDimensions().size(); ++d)
+        {
+            if(schema.getDimensions()[d].isAutochunked())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //A copy with interval 1 in place of *: enough to check the parameters and map the input, not to run
+    static ArrayDesc withPlaceholderIntervals(ArrayDesc const& schema)
+    {
+        ArrayDesc result = schema;
+        Dimensions& dims = result.getDimensions();
+        for(size_t d=0; d<dims.size(); ++d)
+        {
+            if(dims[d].isAutochunked())
+            {
+                dims[d].setChunkInterval(1);
+            }
+        }
+        return result;
+    }
+
+    //This instance's share of the input. The input must allow a second pass.
+    void scan(shared_ptr<Array> const& input)
+    {
+        size_t const numInputAttrs = _settings.getNumInputAttrs();
+        vector<size_t> attrs;
+        vector<size_t> columns(_numDims, 0); //into attrs, for the dimensions fed by an attribute
+        for(size_t d=0; d<_numDims; ++d)
+        {
+            if(_attrSources[d] != numInputAttrs)
+            {
+                columns[d] = std::find(attrs.begin(), attrs.end(), _attrSources[d]) - attrs.begin();
+                if(columns[d] == attrs.size())
+                {
+                    attrs.push_back(_attrSources[d]);
+                }
+            }
+        }
+        if(attrs.empty())
+        {
+            attrs.push_back(input->getArrayDesc().getAttributes(true).size()); //empty tag: positions only
+        }
+        vector<shared_ptr<ConstArrayIterator> > aiters(attrs.size());
+        vector<shared_ptr<ConstChunkIterator> > citers(attrs.size());
+        vector<int64_t> coords(_numDims);
+        for(size_t a=0; a<attrs.size(); ++a)
+        {
+            aiters[a] = input->getConstIterator(attrs[a]);
+        }
+        while(!aiters[0]->end())
+        {
+            for(size_t a=0; a<attrs.size(); ++a)
+            {
+                citers[a] = aiters[a]->getChunk().getConstIterator();
+            }
+            while(!citers[0]->end())
+            {
+                bool valid = true;
+                Coordinates const& pos = citers[0]->getPosition();
+                for(size_t d=0; d<_numDims && valid; ++d)
+                {
+                    if(_attrSources[d] != numInputAttrs)
+                    {
+                        Value const& item = citers[columns[d]]->getItem();
+                        valid = !item.isNull();
+                        coords[d] = valid ? item.getInt64() : 0;
+                    }
+                    else if(_dimSources[d] != _settings.getNumInputDims())
+                    {
+                        coords[d] = pos[_dimSources[d]];
+                    }
+                }
+                if(valid)
+                {
+                    ++_numCells;
+                    for(size_t d=0; d<_numDims; ++d)
+                    {
+                        if(_attrSources[d] != numInputAttrs || _dimSources[d] != _settings.getNumInputDims()) //not synthetic
+                        {
+                            DimensionSummary& s = _dims[d];
+                            s.min = std::min(s.min, coords[d]);
+                            s.max = std::max(s.max, coords[d]);
+                            s.distinct.add(coords[d]);
+                        }
+                    }
+                }
+                for(size_t a=0; a<attrs.size(); ++a)
+                {
+                    ++(*citers[a]);
+                }
+            }
+            for(size_t a=0; a<attrs.size(); ++a)
+            {
+                ++(*aiters[a]);
+            }
+        }
+    }
+
+    //Send this instance's summary to every other instance and merge theirs
+    void exchange(shared_ptr<Query>& query)
+    {
+        size_t const numInstances = query->getInstancesCount();
+        InstanceID const myId = query->getInstanceID();
+        vector<uint64_t> const local = serialize();
+        shared_ptr<SharedBuffer> buf(new MemoryBuffer(local.data(), local.size() * sizeof(uint64_t)));
+        for(InstanceID i=0; i<numInstances; ++i)
+        {
+            if(i != myId)
+            {
+                BufSend(i, buf, query);
+            }
+        }
+        for(InstanceID i=0; i<numInstances; ++i)
+        {
+            if(i == myId)
+            {
+                continue;
+            }
+            shared_ptr<SharedBuffer> remote = BufReceive(i, query);
+            uint64_t const* data = static_cast<uint64_t const*>(remote->getData());
+            merge(vector<uint64_t>(data, data + remote->getSize() / sizeof(uint64_t)));
+        }
+    }
+
+    //Set the interval of every auto-chunked dimension of schema
+    void chooseIntervals(ArrayDesc& schema) const
+    {
+        Dimensions& dims = schema.getDimensions();
+        double const target = static_cast<double>(std::max<size_t>(_settings.getTargetCellsPerChunk(), 1));
+        double chunksLeft = std::max(1.0, _numCells / target);
+        vector<double> distinct(_numDims, 1);
+        vector<double> range(_numDims, ceil(pow(target, 1.0 / _numDims))); //where there is no data: about one chunk's worth
+        vector<bool> open(_numDims, false);
+        size_t numOpen = 0;
+        for(size_t d=0; d<_numDims; ++d)
+        {
+            DimensionSummary const& s = _dims[d];
+            if(s.min <= s.max)
+            {
+                distinct[d] = std::max(1.0, s.distinct.estimate());
+                range[d] = static_cast<double>(s.max - s.min) + 1;
+            }
+            if(dims[d].isAutochunked())
+            {
+                open[d] = true;
+                ++numOpen;
+            }
+            else
+            {
+                chunksLeft /= std::max(1.0, std::min(distinct[d], ceil(range[d] / dims[d].getChunkInterval())));
+            }
+        }
+        vector<double> chunks(_numDims, 1);
+        while(numOpen > 0) //hand out what is left evenly; a dimension with fewer distinct values takes them all and drops out
+        {
+            double const share = pow(std::max(1.0, chunksLeft), 1.0 / numOpen);
+            bool capped = false;
+            for(size_t d=0; d<_numDims; ++d)
+            {
+                if(open[d] && distinct[d] <= share)
+                {
+                    chunks[d] = distinct[d];
+                    chunksLeft /= distinct[d];
+                    open[d] = false;
+                    --numOpen;
+                    capped = true;
+                }
+            }
+            if(capped)
+            {
+                continue;
+            }
+            for(size_t d=0; d<_numDims; ++d)
+            {
+                if(open[d])
+                {
+                    chunks[d] = share;
+                    open[d] = false;
+                }
+            }
+            numOpen = 0;
+        }
+        ostringstream out;
+        for(size_t d=0; d<_numDims; ++d)
+        {
+            if(!dims[d].isAutochunked())
+            {
+                continue;
+            }
+            int64_t interval = static_cast<int64_t>(ceil(range[d] / chunks[d]));
+            if(dims[d].getEndMax() != CoordinateBounds::getMax())
+            {
+                interval = std::min<int64_t>(interval, dims[d].getEndMax() - dims[d].getStartMin() + 1);
+            }
+            interval = std::max<int64_t>(interval, 1);
+            dims[d].setChunkInterval(interval);
+            out<<dims[d].getBaseName()<<"="<<interval<<" (range "<<range[d]<<", ~"<<distinct[d]<<" distinct) ";
+        }
+        LOG4CXX_DEBUG(logger, "FR auto-chunked over "<<_numCells<<" cells: "<<out.str().c_str());
+    }
+};
+
+} } //namespaces
+
+#endif /* AUTOCHUNK_H_ */
@@ -32,6 +32,7 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 #include <util/ArrayCoordinatesMapper.h>
+#include "RedimStats.h"
 
 namespace scidb
 {
@@ -53,6 +54,79 @@ using boost::bad_lexical_cast;
 // Logger for operator. static to prevent visibility of variable outside of file
 static log4cxx::LoggerPtr logger(log4cxx::Logger::getLogger("scidb.operators.faster_redimension"));
 
+enum SortEngine
+{
+    SORT_ENGINE_RADIX,      //LSD radix sort over the normalized tuple key, skipping constant bytes
+    SORT_ENGINE_COMPARISON  //std::sort with memcmp over the normalized tuple key
+};
+
+enum SgFormat
+{
+    SG_FORMAT_TUPLES,   //packed row tuples: [uint32 size][tuple]...
+    SG_FORMAT_COLUMNAR, //keys, then one column per attribute
+    SG_FORMAT_DELTA     //instance and chunk once per run of tuples, positions as varint deltas
+};
+
+enum SgCompression
+{
+    SG_COMPRESSION_NONE,  //blobs go out as packed
+    SG_COMPRESSION_LZ     //LZBlock (LZ4 block format) over each blob, kept only if it is smaller
+};
+
+enum RedimStrategy
+{
+    STRATEGY_SORT_MERGE,  //sort locally, SG sorted runs, k-way merge on the receiving instance
+    STRATEGY_SCATTER,     //SG unsorted tuples straight from the scan, one local sort on the receiving instance
+    STRATEGY_PIPELINED    //like sort_merge, but sort each destination apart and send the first ones while the rest sort
+};
+
+enum CollisionPolicy
+{
+    COLLISION_ERROR, //fail the query on the first collision
+    COLLISION_FIRST, //keep the cell that comes first: source instance order, then the order that instance scans its input
+    COLLISION_LAST,  //keep the cell that comes last, in the same order
+    COLLISION_ANY    //keep whichever cell the merge sees first; no ordering is forced on the sort
+};
+
+enum AggregateFunction
+{
+    AGGREGATE_SUM,
+    AGGREGATE_COUNT,
+    AGGREGATE_MIN,
+    AGGREGATE_MAX,
+    AGGREGATE_AVG
+};
+
+enum AggregateValueKind
+{
+    AGGREGATE_VALUE_SIGNED,   //int8 ... int64, widened to int64 in the state
+    AGGREGATE_VALUE_UNSIGNED, //uint8 ... uint64, widened to uint64
+    AGGREGATE_VALUE_FLOAT     //float or double, widened to double
+};
+
+/*
+ * One aggregate=... call, e.g. sum(v) as s. In the tuples the output attribute carries the partial state of the
+ * aggregate instead of a value: [uint64 count][8-byte value] - count(...) has the count only. The state slot is never
+ * null; a count of 0 stands for no values yet. See Aggregates.h.
+ */
+struct AggregateSpec
+{
+    AggregateFunction  function;
+    string             inputName;   //"*" for count(*)
+    string             outputName;
+    size_t             inputColumn; //into getInputAttributesRead(); NO_INPUT_COLUMN for count(*)
+    size_t             outputAttr;
+    AggregateValueKind kind;        //of the input
+    size_t             inputSize;
+    size_t             outputSize;
+};
+
+enum OutputWriterMode
+{
+    OUTPUT_WRITER_ITERATOR, //setPosition and writeItem through a chunk iterator per attribute
+    OUTPUT_WRITER_RLE       //build each chunk's RLE payload and empty bitmap directly
+};
+
 class Settings
 {
 private:
@@ -76,16 +150,43 @@ private:
     vector<bool>                  _outputAttributeNullable;
     size_t                        _estTupleSizeBytes;
     bool                          _estTupleSizeBytesSet;
+    size_t                        _sampledTupleSizeBytes;       //0 until setSampledTupleSize
     size_t                        _sortedArrayChunkSize;
     bool                          _sortedArrayChunkSizeSet;
     size_t                        _sortChunkSizeLimitBytes;
     bool                          _sortChunkSizeLimitBytesSet;
     size_t                        _sgChunkSizeLimitBytes;
     bool                          _sgChunkSizeLimitBytesSet;
+    size_t                        _sortThreads;
+    bool                          _sortThreadsSet;
+    SortEngine                    _sortEngine;
+    bool                          _sortEngineSet;
+    SgFormat                      _sgFormat;
+    bool                          _sgFormatSet;
+    RedimStrategy                 _strategy;
+    bool                          _strategySet;
+    SgCompression                 _sgCompression;
+    bool                          _sgCompressionSet;
+    OutputWriterMode              _outputWriter;
+    bool                          _outputWriterSet;
+    size_t                        _outputThreads;
+    bool                          _outputThreadsSet;
+    size_t                        _mergeThreads;
+    bool                          _mergeThreadsSet;
+    size_t                        _memoryBudgetBytes;
+    bool                          _memoryBudgetBytesSet;
+    CollisionPolicy               _onCollision;
+    bool                          _onCollisionSet;
+    vector<AggregateSpec>         _aggregates;
+    bool                          _aggregatesSet;
+    size_t                        _targetCellsPerChunk;
+    bool                          _targetCellsPerChunkSet;
+    size_t                        _mergeSortBufferBytes;
     bool                          _haveSynthetic;
     size_t                        _syntheticId;
     Coordinate                    _syntheticMin;
     Coordinate                    _syntheticMax;
+    shared_ptr<RedimStats> const  _stats;
 
     static string paramToString(shared_ptr <OperatorParam> const& parameter, shared_ptr<Query>& query, bool logical)
     {
@@ -96,7 +197,7 @@ private:
         return ((shared_ptr<OperatorParamPhysicalExpression>&) parameter)->getExpression()->evaluate().getString();
     }
 
-    void setSizeParam (string const& parameterString, bool& alreadySet, string const& header, size_t& param )
+    string getParamContent(string const& parameterString, bool& alreadySet, string const& header)
     {
         string paramContent = parameterString.substr(header.size());
         if (alreadySet)
@@ -107,6 +208,12 @@ private:
             throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << error.str().c_str();
         }
         trim(paramContent);
+        return paramContent;
+    }
+
+    void setSizeParam (string const& parameterString, bool& alreadySet, string const& header, size_t& param )
+    {
+        string paramContent = getParamContent(parameterString, alreadySet, header);
         int64_t content;
         try
         {
@@ -131,7 +238,9 @@ private:
     }
 
 public:
-    static size_t const MAX_PARAMETERS = 5; //1 for the schema
+    static size_t const MAX_PARAMETERS = 17; //1 for the schema
+    static size_t const AGGREGATE_INPUT_ONLY = static_cast<size_t>(-1); //input attribute destination: read for an aggregate only
+    static size_t const NO_INPUT_COLUMN      = static_cast<size_t>(-1);
 
     Settings(ArrayDesc const& inputSchema,
              ArrayDesc const& outputSchema,
@@ -157,18 +266,56 @@ public:
         _outputAttributeSizes(_numOutputAttrs),
         _outputAttributeNullable(_numOutputAttrs),
         _estTupleSizeBytesSet(false),
+        _sampledTupleSizeBytes(0),
         _sortedArrayChunkSizeSet(false),
         _sortChunkSizeLimitBytesSet(false),
         _sgChunkSizeLimitBytesSet(false),
+        _sortThreads(0),
+        _sortThreadsSet(false),
+        _sortEngine(SORT_ENGINE_RADIX),
+        _sortEngineSet(false),
+        _sgFormat(SG_FORMAT_TUPLES),
+        _sgFormatSet(false),
+        _strategy(STRATEGY_SORT_MERGE),
+        _strategySet(false),
+        _sgCompression(SG_COMPRESSION_NONE),
+        _sgCompressionSet(false),
+        _outputWriter(OUTPUT_WRITER_ITERATOR),
+        _outputWriterSet(false),
+        _outputThreads(0),
+        _outputThreadsSet(false),
+        _mergeThreads(0),
+        _mergeThreadsSet(false),
+        _memoryBudgetBytes(0),
+        _memoryBudgetBytesSet(false),
+        _onCollision(COLLISION_ERROR),
+        _onCollisionSet(false),
+        _aggregatesSet(false),
+        _targetCellsPerChunk(0),
+        _targetCellsPerChunkSet(false),
+        _mergeSortBufferBytes(0),
         _haveSynthetic(false),
         _syntheticId(0),
         _syntheticMin(0),
-        _syntheticMax(0)
+        _syntheticMax(0),
+        _stats(std::make_shared<RedimStats>(_numInstances))
     {
         string const estTupleSizeBytesHeader       = "est_tuple_size_bytes=";        //estimation on how big each tuple is (sort uses this to size the buffer to fit in memory)
         string const sortedChunkSizeHeader         = "sorted_array_chunk_size=";     //chunk size for the output of the sort routine
         string const sortChunkSizeLimitBytesHeader = "sort_chunk_size_limit_bytes="; //limit on chunks that are fed in to sort, not a big deal as long as it's under MERGE_SORT_BUFFER
         string const sgChunkSizeLimitBytesHeader   = "sg_chunk_size_limit_bytes=";   //limit on the chunks that are fed in to post sort SG: a chunk from each instance should fit in memory
+        string const sortThreadsHeader             = "sort_threads=";                //sort runs on this many threads instead of using SortArray
+        string const sortEngineHeader              = "sort_engine=";                 //radix or comparison; how the runs are sorted (implies the run sorter)
+        string const sgFormatHeader                = "sg_format=";                   //tuples, columnar or delta; layout of the blobs exchanged in the SG
+        string const strategyHeader                = "strategy=";                    //sort_merge, scatter or pipelined; how the sort and the SG are ordered
+        string const sgCompressionHeader           = "sg_compression=";              //none or lz; compression of the blobs exchanged in the SG
+        string const outputWriterHeader            = "output_writer=";               //iterator or rle; how the output chunks are written
+        string const outputThreadsHeader           = "output_threads=";              //write the attribute chunks of each output chunk on this many threads
+        string const mergeThreadsHeader            = "merge_threads=";               //split the merge after the SG into this many ranges of output chunks
+        string const memoryBudgetBytesHeader       = "memory_budget_bytes=";         //memory for the query on each instance; chunk limits then adapt as it runs
+        string const onCollisionHeader             = "on_collision=";                //error, first, last or any; what to do with cells that land on the same position
+        string const aggregateHeader               = "aggregate=";                   //sum|count|min|max|avg(input) as output, ...; combine colliding cells
+        string const targetCellsPerChunkHeader     = "target_cells_per_chunk=";      //what auto-chunked target dimensions aim for
         size_t const nParams = operatorParameters.size();
         if (nParams > MAX_PARAMETERS)
         {   //assert-like exception. Caller should have taken care of this!
@@ -193,6 +340,149 @@ public:
           {
               setSizeParam(parameterString, _sgChunkSizeLimitBytesSet, sgChunkSizeLimitBytesHeader, _sgChunkSizeLimitBytes);
           }
+          else if (starts_with(parameterString, sortThreadsHeader))
+          {
+              setSizeParam(parameterString, _sortThreadsSet, sortThreadsHeader, _sortThreads);
+          }
+          else if (starts_with(parameterString, sortEngineHeader))
+          {
+              string engine = getParamContent(parameterString, _sortEngineSet, sortEngineHeader);
+              if(engine == "radix")
+              {
+                  _sortEngine = SORT_ENGINE_RADIX;
+              }
+              else if(engine == "comparison")
+              {
+                  _sortEngine = SORT_ENGINE_COMPARISON;
+              }
+              else
+              {
+                  throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "sort_engine must be radix or comparison";
+              }
+              _sortEngineSet = true;
+          }
+          else if (starts_with(parameterString, sgFormatHeader))
+          {
+              string format = getParamContent(parameterString, _sgFormatSet, sgFormatHeader);
+              if(format == "tuples")
+              {
+                  _sgFormat = SG_FORMAT_TUPLES;
+              }
+              else if(format == "columnar")
+              {
+                  _sgFormat = SG_FORMAT_COLUMNAR;
+              }
+              else if(format == "delta")
+              {
+                  _sgFormat = SG_FORMAT_DELTA;
+              }
+              else
+              {
+                  throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "sg_format must be tuples, columnar or delta";
+              }
+              _sgFormatSet = true;
+          }
+          else if (starts_with(parameterString, strategyHeader))
+          {
+              string strategy = getParamContent(parameterString, _strategySet, strategyHeader);
+              if(strategy == "sort_merge")
+              {
+                  _strategy = STRATEGY_SORT_MERGE;
+              }
+              else if(strategy == "scatter")
+              {
+                  _strategy = STRATEGY_SCATTER;
+              }
+              else if(strategy == "pipelined")
+              {
+                  _strategy = STRATEGY_PIPELINED;
+              }
+              else
+              {
+                  throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "strategy must be sort_merge, scatter or pipelined";
+              }
+              _strategySet = true;
+          }
+          else if (starts_with(parameterString, sgCompressionHeader))
+          {
+              string compression = getParamContent(parameterString, _sgCompressionSet, sgCompressionHeader);
+              if(compression == "none")
+              {
+                  _sgCompression = SG_COMPRESSION_NONE;
+              }
+              else if(compression == "lz")
+              {
+                  _sgCompression = SG_COMPRESSION_LZ;
+              }
+              else
+              {
+                  throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "sg_compression must be none or lz";
+              }
+              _sgCompressionSet = true;
+          }
+          else if (starts_with(parameterString, outputWriterHeader))
+          {
+              string writer = getParamContent(parameterString, _outputWriterSet, outputWriterHeader);
+              if(writer == "iterator")
+              {
+                  _outputWriter = OUTPUT_WRITER_ITERATOR;
+              }
+              else if(writer == "rle")
+              {
+                  _outputWriter = OUTPUT_WRITER_RLE;
+              }
+              else
+              {
+                  throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "output_writer must be iterator or rle";
+              }
+              _outputWriterSet = true;
+          }
+          else if (starts_with(parameterString, outputThreadsHeader))
+          {
+              setSizeParam(parameterString, _outputThreadsSet, outputThreadsHeader, _outputThreads);
+          }
+          else if (starts_with(parameterString, mergeThreadsHeader))
+          {
+              setSizeParam(parameterString, _mergeThreadsSet, mergeThreadsHeader, _mergeThreads);
+          }
+          else if (starts_with(parameterString, memoryBudgetBytesHeader))
+          {
+              setSizeParam(parameterString, _memoryBudgetBytesSet, memoryBudgetBytesHeader, _memoryBudgetBytes);
+          }
+          else if (starts_with(parameterString, onCollisionHeader))
+          {
+              string policy = getParamContent(parameterString, _onCollisionSet, onCollisionHeader);
+              if(policy == "error")
+              {
+                  _onCollision = COLLISION_ERROR;
+              }
+              else if(policy == "first")
+              {
+                  _onCollision = COLLISION_FIRST;
+              }
+              else if(policy == "last")
+              {
+                  _onCollision = COLLISION_LAST;
+              }
+              else if(policy == "any")
+              {
+                  _onCollision = COLLISION_ANY;
+              }
+              else
+              {
+                  throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "on_collision must be error, first, last or any";
+              }
+              _onCollisionSet = true;
+          }
+          else if (starts_with(parameterString, aggregateHeader))
+          {
+              _aggregates = parseAggregates(getParamContent(parameterString, _aggregatesSet, aggregateHeader));
+              _aggregatesSet = true;
+          }
+          else if (starts_with(parameterString, targetCellsPerChunkHeader))
+          {
+              setSizeParam(parameterString, _targetCellsPerChunkSet, targetCellsPerChunkHeader, _targetCellsPerChunk);
+          }
           else
           {
               ostringstream error;
@@ -200,6 +490,8 @@ public:
               throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << error.str().c_str();
           }
         }
+        throwIf(_strategy == STRATEGY_SCATTER && _sgFormat != SG_FORMAT_TUPLES,
+                "sg_format does not go with strategy=scatter: scatter sends unsorted tuples, as sg_format=tuples");
         mapInputToOutput();
         computeChunkSizes();
         logSettings();
@@ -214,6 +506,169 @@ private:
         }
     }
 
+    //"sum(v) as s, count(*) as n" -> one spec per call; resolveAggregates matches them to the schemas
+    static vector<AggregateSpec> parseAggregates(string const& content)
+    {
+        vector<AggregateSpec> result;
+        vector<string> calls;
+        boost::algorithm::split(calls, content, boost::algorithm::is_any_of(","));
+        for(size_t i=0; i<calls.size(); ++i)
+        {
+            string call = calls[i];
+            trim(call);
+            size_t const open  = call.find('(');
+            size_t const close = call.find(')');
+            if(open == string::npos || close == string::npos || close < open)
+            {
+                throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "aggregate calls look like sum(input) as output";
+            }
+            string function = call.substr(0, open);
+            string input    = call.substr(open + 1, close - open - 1);
+            string rest     = call.substr(close + 1);
+            trim(function);
+            trim(input);
+            trim(rest);
+            if(!starts_with(rest, "as ") || input.empty())
+            {
+                throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "aggregate calls look like sum(input) as output";
+            }
+            AggregateSpec spec;
+            spec.inputName  = input;
+            spec.outputName = rest.substr(3);
+            trim(spec.outputName);
+            if     (function == "sum")   { spec.function = AGGREGATE_SUM;   }
+            else if(function == "count") { spec.function = AGGREGATE_COUNT; }
+            else if(function == "min")   { spec.function = AGGREGATE_MIN;   }
+            else if(function == "max")   { spec.function = AGGREGATE_MAX;   }
+            else if(function == "avg")   { spec.function = AGGREGATE_AVG;   }
+            else
+            {
+                throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "aggregate must be sum, count, min, max or avg";
+            }
+            if(input == "*" && spec.function != AGGREGATE_COUNT)
+            {
+                throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "only count takes *";
+            }
+            spec.inputColumn = NO_INPUT_COLUMN;
+            spec.outputAttr  = 0;
+            spec.kind        = AGGREGATE_VALUE_UNSIGNED;
+            spec.inputSize   = 0;
+            spec.outputSize  = 0;
+            result.push_back(spec);
+        }
+        return result;
+    }
+
+    /*
+     * Find the input and output attribute of every aggregate and check the output type: sum is int64, uint64 or
+     * double by the input, min and max keep the input type, avg is double and count is uint64. The input is read
+     * as a column of its own unless a plain output attribute reads it already. The output attribute carries the
+     * state in the tuples - see AggregateSpec.
+     */
+    void resolveAggregates()
+    {
+        vector<bool> taken(_numOutputAttrs, false);
+        for(size_t k=0; k<_aggregates.size(); ++k)
+        {
+            AggregateSpec& a = _aggregates[k];
+            ostringstream error;
+            bool found = false;
+            for(size_t j =0; j<_numOutputAttrs && !found; ++j)
+            {
+                if(_outputSchema.getAttributes(true)[j].getName() == a.outputName)
+                {
+                    a.outputAttr = j;
+                    found = true;
+                }
+            }
+            if(!found || taken[a.outputAttr])
+            {
+                error<<"aggregate output "<<a.outputName<<" must be an attribute of the target, once";
+                throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << error.str().c_str();
+            }
+            taken[a.outputAttr] = true;
+            AttributeDesc const& outputAttr = _outputSchema.getAttributes(true)[a.outputAttr];
+            TypeId resultType = TID_UINT64;
+            if(a.inputName != "*")
+            {
+                size_t input = _numInputAttrs;
+                for(size_t i=0; i<_numInputAttrs; ++i)
+                {
+                    if(_inputSchema.getAttributes(true)[i].getName() == a.inputName)
+                    {
+                        input = i;
+                    }
+                }
+                if(input == _numInputAttrs)
+                {
+                    error<<"aggregate input "<<a.inputName<<" is not an attribute of the input";
+                    throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << error.str().c_str();
+                }
+                TypeId const& type = _inputSchema.getAttributes(true)[input].getType();
+                if(type == TID_INT8 || type == TID_INT16 || type == TID_INT32 || type == TID_INT64)
+                {
+                    a.kind = AGGREGATE_VALUE_SIGNED;
+                }
+                else if(type == TID_UINT8 || type == TID_UINT16 || type == TID_UINT32 || type == TID_UINT64)
+                {
+                    a.kind = AGGREGATE_VALUE_UNSIGNED;
+                }
+                else if(type == TID_FLOAT || type == TID_DOUBLE)
+                {
+                    a.kind = AGGREGATE_VALUE_FLOAT;
+                }
+                else
+                {
+                    error<<"cannot aggregate "<<a.inputName<<": only numeric attributes";
+                    throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << error.str().c_str();
+                }
+                a.inputSize = _inputSchema.getAttributes(true)[input].getSize();
+                for(size_t c=0; c<_numInputAttributesRead && a.inputColumn == NO_INPUT_COLUMN; ++c)
+                {
+                    if(_inputAttributesRead[c] == input)
+                    {
+                        if(_inputAttributeDestinations[c] >= _numOutputAttrs && _inputAttributeDestinations[c] != AGGREGATE_INPUT_ONLY)
+                        {
+                            error<<"cannot aggregate "<<a.inputName<<": it is a target dimension";
+                            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << error.str().c_str();
+                        }
+                        a.inputColumn = c;
+                    }
+                }
+                if(a.inputColumn == NO_INPUT_COLUMN)
+                {
+                    a.inputColumn = _numInputAttributesRead++;
+                    _inputAttributesRead.push_back(input);
+                    _inputAttributeDestinations.push_back(AGGREGATE_INPUT_ONLY);
+                    _inputAttributeFilterNull.push_back(false);
+                }
+                switch(a.function)
+                {
+                case AGGREGATE_SUM: resultType = a.kind == AGGREGATE_VALUE_SIGNED ? TID_INT64 : a.kind == AGGREGATE_VALUE_UNSIGNED ? TID_UINT64 : TID_DOUBLE; break;
+                case AGGREGATE_MIN:
+                case AGGREGATE_MAX: resultType = type;       break;
+                case AGGREGATE_AVG: resultType = TID_DOUBLE; break;
+                default:            break;
+                }
+            }
+            if(outputAttr.getType() != resultType)
+            {
+                error<<"aggregate output "<<a.outputName<<" must be of type "<<resultType;
+                throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << error.str().c_str();
+            }
+            if(a.function != AGGREGATE_COUNT && !outputAttr.isNullable())
+            {
+                error<<"aggregate output "<<a.outputName<<" must be nullable: it is null where there are no input values";
+                throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << error.str().c_str();
+            }
+            a.outputSize = outputAttr.getSize();
+            _outputAttributeSizes[a.outputAttr] = getAggregateStateSize(a.function);
+            _outputAttributeNullable[a.outputAttr] = false;
+        }
+        throwIf(_aggregates.size() && _haveSynthetic, "aggregate does not go with a synthetic dimension");
+        throwIf(_aggregates.size() && _onCollisionSet, "on_collision does not go with aggregate: colliding cells are combined");
+    }
+
     void mapInputToOutput()
     {
         for(size_t i=0; i<_numInputAttrs; ++i)
@@ -223,7 +678,7 @@ private:
             for(size_t j =0; j<_numOutputAttrs && !found; ++j)
             {
                 AttributeDesc const& outputAttr = _outputSchema.getAttributes(true)[j];
-                if (inputAttr.getName() == outputAttr.getName())
+                if (inputAttr.getName() == outputAttr.getName() && !isAggregateOutput(outputAttr.getName()))
                 {
                     _numInputAttributesRead ++;
                     _inputAttributesRead.push_back(i);
@@ -252,7 +707,7 @@ private:
             for(size_t j =0; j<_numOutputAttrs && !found; ++j)
             {
                 AttributeDesc const& outputAttr = _outputSchema.getAttributes(true)[j];
-                if (inputDim.hasNameAndAlias(outputAttr.getName()))
+                if (inputDim.hasNameAndAlias(outputAttr.getName()) && !isAggregateOutput(outputAttr.getName()))
                 {
                     _numInputDimensionsRead ++;
                     _inputDimensionsRead.push_back(i);
@@ -310,23 +765,28 @@ private:
                 _syntheticMax = outputDim.getStartMin() + outputDim.getChunkInterval() - 1;
             }
         }
+        resolveAggregates();
+    }
+
+    //About 10MB of tuples per sorted chunk
+    static size_t computeSortedArrayChunkSize(size_t const tupleSize)
+    {
+        return std::max<size_t>((10 * 1024 * 1024) / std::max<size_t>(tupleSize, 1), 10);
     }
 
     void computeChunkSizes()
     {
         if(!_estTupleSizeBytesSet) //Customer's always right!
         {
-            _estTupleSizeBytes = computeApproximateTupleSize();
+            _estTupleSizeBytes = _sampledTupleSizeBytes ? _sampledTupleSizeBytes : computeApproximateTupleSize();
         }
         if(!_sortedArrayChunkSizeSet)
         {
-            _sortedArrayChunkSize = (10 * 1024 * 1024) / _estTupleSizeBytes;
-            if(_sortedArrayChunkSize < 10)
-            {
-                _sortedArrayChunkSize = 10;
-            }
+            _sortedArrayChunkSize = computeSortedArrayChunkSize(_estTupleSizeBytes);
         }
-        size_t const mergeSortBuf = (Config::getInstance()->getOption<int>(CONFIG_MERGE_SORT_BUFFER) * 1024 * 1024);
+        size_t const mergeSortBuf = _memoryBudgetBytesSet ? _memoryBudgetBytes :
+                                    (Config::getInstance()->getOption<int>(CONFIG_MERGE_SORT_BUFFER) * 1024 * 1024);
+        _mergeSortBufferBytes = mergeSortBuf;
         if(!_sortChunkSizeLimitBytesSet)
         {
             _sortChunkSizeLimitBytes = mergeSortBuf / 8;
@@ -367,7 +827,20 @@ private:
               <<" est_tuple_size_bytes="<<_estTupleSizeBytes
               <<" sorted_array_chunk_size="<<_sortedArrayChunkSize
               <<" sort_chunk_size_limit_bytes="<<_sortChunkSizeLimitBytes
-              <<" sg_chunk_size_limit_bytes="<<_sgChunkSizeLimitBytes;
+              <<" sg_chunk_size_limit_bytes="<<_sgChunkSizeLimitBytes
+              <<" sort_threads="<<_sortThreads
+              <<" sort_engine="<<(_sortEngine == SORT_ENGINE_RADIX ? "radix" : "comparison")
+              <<" sg_format="<<(_sgFormat == SG_FORMAT_TUPLES ? "tuples" : _sgFormat == SG_FORMAT_COLUMNAR ? "columnar" : "delta")
+              <<" strategy="<<(_strategy == STRATEGY_SORT_MERGE ? "sort_merge" : _strategy == STRATEGY_SCATTER ? "scatter" : "pipelined")
+              <<" sg_compression="<<(_sgCompression == SG_COMPRESSION_NONE ? "none" : "lz")
+              <<" output_writer="<<(_outputWriter == OUTPUT_WRITER_ITERATOR ? "iterator" : "rle")
+              <<" output_threads="<<_outputThreads
+              <<" merge_threads="<<_mergeThreads
+              <<" memory_budget_bytes="<<_memoryBudgetBytes
+              <<" aggregates="<<_aggregates.size()
+              <<" target_cells_per_chunk="<<getTargetCellsPerChunk()
+              <<" on_collision="<<(_onCollision == COLLISION_ERROR ? "error" : _onCollision == COLLISION_FIRST ? "first" :
+                                   _onCollision == COLLISION_LAST  ? "last"  : "any");
         LOG4CXX_DEBUG(logger, "FR tuple mapping "<<output.str().c_str());
     }
 
@@ -397,11 +870,40 @@ public:
         return _sortedArrayChunkSize;
     }
 
+    //The chunk size for a sorted array of tuples known to average tupleSize bytes, if the estimate is only a guess
+    size_t getSortedArrayChunkSize(size_t const tupleSize) const
+    {
+        if(_sortedArrayChunkSizeSet || tupleSize == 0 || !needTupleSizeSample())
+        {
+            return _sortedArrayChunkSize;
+        }
+        return computeSortedArrayChunkSize(tupleSize);
+    }
+
     size_t getNumInputAttributesRead() const
     {
         return _numInputAttributesRead;
     }
 
+    /**
+     * True when no input attribute is read: every output attribute, if any, is an input dimension or the state of a
+     * count(*) aggregate. Those are fixed size and never null, so all tuples have the same size - getFixedTupleSize().
+     */
+    bool isDimensionOnly() const
+    {
+        return _numInputAttributesRead == 0;
+    }
+
+    size_t getFixedTupleSize() const
+    {
+        size_t result = sizeof(uint8_t) + sizeof(uint32_t) + sizeof(Coordinate) * (getNumOutputDims() + 1);
+        for(size_t i =0; i<_numOutputAttrs; ++i)
+        {
+            result += (_outputAttributeNullable[i] ? sizeof(int8_t) : 0) + _outputAttributeSizes[i];
+        }
+        return result;
+    }
+
     vector<size_t> const& getInputAttributesRead() const
     {
         return _inputAttributesRead;
@@ -472,6 +974,147 @@ public:
         return _sgChunkSizeLimitBytes;
     }
 
+    //SortArray does not keep equal tuples in input order, which on_collision=first|last needs
+    bool useRunSorter() const
+    {
+        return _sortThreadsSet || _sortEngineSet || _onCollision == COLLISION_FIRST || _onCollision == COLLISION_LAST;
+    }
+
+    CollisionPolicy getCollisionPolicy() const
+    {
+        return _onCollision;
+    }
+
+    static size_t getAggregateStateSize(AggregateFunction const function)
+    {
+        return function == AGGREGATE_COUNT ? sizeof(uint64_t) : 2 * sizeof(uint64_t);
+    }
+
+    bool haveAggregates() const
+    {
+        return _aggregates.size() > 0;
+    }
+
+    vector<AggregateSpec> const& getAggregates() const
+    {
+        return _aggregates;
+    }
+
+    bool isAggregateOutput(string const& name) const
+    {
+        for(size_t k=0; k<_aggregates.size(); ++k)
+        {
+            if(_aggregates[k].outputName == name)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t getSortThreads() const
+    {
+        return _sortThreadsSet ? _sortThreads : 1;
+    }
+
+    SortEngine getSortEngine() const
+    {
+        return _sortEngine;
+    }
+
+    SgFormat getSgFormat() const
+    {
+        return _sgFormat;
+    }
+
+    RedimStrategy getStrategy() const
+    {
+        return _strategy;
+    }
+
+    SgCompression getSgCompression() const
+    {
+        return _sgCompression;
+    }
+
+    OutputWriterMode getOutputWriter() const
+    {
+        return _outputWriter;
+    }
+
+    size_t getOutputThreads() const
+    {
+        return _outputThreadsSet ? _outputThreads : 1;
+    }
+
+    size_t getMergeThreads() const
+    {
+        return _mergeThreadsSet ? _mergeThreads : 1;
+    }
+
+    size_t getTargetCellsPerChunk() const
+    {
+        return _targetCellsPerChunkSet ? _targetCellsPerChunk : static_cast<size_t>(Config::getInstance()->getOption<int>(CONFIG_TARGET_CELLS_PER_CHUNK));
+    }
+
+    bool haveMemoryBudget() const
+    {
+        return _memoryBudgetBytesSet;
+    }
+
+    bool sortChunkSizeLimitSet() const
+    {
+        return _sortChunkSizeLimitBytesSet;
+    }
+
+    bool sgChunkSizeLimitSet() const
+    {
+        return _sgChunkSizeLimitBytesSet;
+    }
+
+    size_t getEstTupleSize() const
+    {
+        return _estTupleSizeBytes;
+    }
+
+    //Whether the tuple size is only a guess: est_tuple_size_bytes was not given and some attribute has variable size
+    bool needTupleSizeSample() const
+    {
+        if(_estTupleSizeBytesSet)
+        {
+            return false;
+        }
+        for(size_t i=0; i<_numOutputAttrs; ++i)
+        {
+            if(_outputAttributeSizes[i] == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /*
+     * Replace the guessed tuple size (CONFIG_STRING_SIZE_ESTIMATION bytes per variable size attribute) with the
+     * average of numTuples tuples already read from the input, and derive the chunk sizes again from it.
+     */
+    void setSampledTupleSize(size_t const avgTupleSize, size_t const numTuples)
+    {
+        if(_estTupleSizeBytesSet || numTuples == 0)
+        {
+            return;
+        }
+        LOG4CXX_DEBUG(logger, "FR sampled tuple size "<<avgTupleSize<<" over "<<numTuples<<" tuples; estimate was "<<_estTupleSizeBytes);
+        _sampledTupleSizeBytes = std::max<size_t>(avgTupleSize, 1);
+        computeChunkSizes();
+        logSettings();
+    }
+
+    size_t getMergeSortBufferSize() const
+    {
+        return _mergeSortBufferBytes;
+    }
+
     size_t computeApproximateTupleSize() const
     {
         size_t result =  sizeof(uint8_t) + sizeof(uint32_t) + sizeof(Coordinate)*_numOutputDims + sizeof(position_t);
@@ -524,6 +1167,16 @@ public:
         return ArrayDesc("redimension_presort" , outputAttributes, outputDimensions, defaultPartitioning(), query->getDefaultArrayResidency());
     }
 
+    ArrayDesc makeRunSchema(shared_ptr<Query> const& query) const
+    {
+        Attributes outputAttributes(2);
+        outputAttributes[0] = AttributeDesc(0, "tuple", "redimension_tuple", 0,0);
+        outputAttributes[1] = AttributeDesc(1, DEFAULT_EMPTY_TAG_ATTRIBUTE_NAME, TID_INDICATOR, AttributeDesc::IS_EMPTY_INDICATOR, 0);
+        Dimensions outputDimensions;
+        outputDimensions.push_back(DimensionDesc("value_no",        0,  CoordinateBounds::getMax(),               _sortedArrayChunkSize,  0));
+        return ArrayDesc("redimension_run" , outputAttributes, outputDimensions, defaultPartitioning(), query->getDefaultArrayResidency());
+    }
+
     ArrayDesc makeSgSchema(shared_ptr<Query> const& query) const
     {
         Attributes outputAttributes(1);
@@ -540,6 +1193,16 @@ public:
         return _outputSchema;
     }
 
+    RedimStats& getStats() const
+    {
+        return *_stats;
+    }
+
+    shared_ptr<RedimStats> const& getStatsPtr() const
+    {
+        return _stats;
+    }
+
 };
 
 } } //namespaces
@@ -25,12 +25,14 @@
 
 #include "query/Operator.h"
 #include "FasterRedimensionSettings.h"
+#include "AutoChunk.h"
 
 namespace scidb
 {
 
 using namespace std;
 using faster_redimension::Settings;
+using faster_redimension::AutoChunker;
 
 class LogicalFastRedim : public LogicalOperator
 {
@@ -63,49 +65,6 @@ public:
         {
             throw USER_EXCEPTION(SCIDB_SE_INFER_SCHEMA, SCIDB_LE_OP_REDIMENSION_ERROR1);
         }
-        size_t numPreservedAttributes = 0;
-        for (const AttributeDesc &dstAttr : dstDesc.getAttributes())
-        {
-            for (const AttributeDesc &srcAttr : srcDesc.getAttributes())
-            {
-                if (srcAttr.getName() == dstAttr.getName())
-                {
-                    if (srcAttr.getType() != dstAttr.getType())
-                    {
-                        throw USER_EXCEPTION(SCIDB_SE_INFER_SCHEMA, SCIDB_LE_WRONG_ATTRIBUTE_TYPE)
-                        << srcAttr.getName() << srcAttr.getType() << dstAttr.getType();
-                    }
-                    if (!dstAttr.isNullable() && srcAttr.isNullable())
-                    {
-                        throw USER_EXCEPTION(SCIDB_SE_INFER_SCHEMA, SCIDB_LE_WRONG_ATTRIBUTE_FLAGS)
-                        << srcAttr.getName();
-                    }
-                    if (!srcAttr.isEmptyIndicator())
-                    {
-                        ++numPreservedAttributes;
-                    }
-                    goto NextAttr;
-                }
-            }
-            for (const DimensionDesc &srcDim : srcDesc.getDimensions())
-            {
-                if (srcDim.hasNameAndAlias(dstAttr.getName()))
-                {
-                    if (dstAttr.getType() != TID_INT64)
-                    {
-                        throw USER_EXCEPTION(SCIDB_SE_INFER_SCHEMA, SCIDB_LE_WRONG_DESTINATION_ATTRIBUTE_TYPE)
-                        << dstAttr.getName() << TID_INT64;
-                    }
-                    goto NextAttr;
-                }
-            }
-            if (dstAttr.isEmptyIndicator() == false)
-            {
-                throw USER_EXCEPTION(SCIDB_SE_INFER_SCHEMA, SCIDB_LE_UNEXPECTED_DESTINATION_ATTRIBUTE)
-                << dstAttr.getName();
-            }
-        NextAttr:;
-        }
         Dimensions outputDims;
         size_t nNewDims = 0;
         for (const DimensionDesc &dstDim : dstDesc.getDimensions())
@@ -137,6 +96,10 @@ public:
                 }
             }
             nNewDims ++;
+            if (dstDim.isAutochunked())
+            {
+                throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "the synthetic dimension needs a chunk interval";
+            }
             outputDims.push_back(dstDim);
             if(nNewDims >= 2)
             {
@@ -150,7 +113,54 @@ public:
                             createDistribution(psUndefined),
                             query->getDefaultArrayResidency(),
                             dstDesc.getFlags());
-        Settings settings(srcDesc, outSchema, _parameters, true, query);
+        Settings settings(srcDesc, AutoChunker::withPlaceholderIntervals(outSchema), _parameters, true, query); //the physical operator picks * intervals
+        size_t numPreservedAttributes = 0;
+        for (const AttributeDesc &dstAttr : dstDesc.getAttributes())
+        {
+            if (settings.isAggregateOutput(dstAttr.getName())) //checked by Settings
+            {
+                continue;
+            }
+            for (const AttributeDesc &srcAttr : srcDesc.getAttributes())
+            {
+                if (srcAttr.getName() == dstAttr.getName())
+                {
+                    if (srcAttr.getType() != dstAttr.getType())
+                    {
+                        throw USER_EXCEPTION(SCIDB_SE_INFER_SCHEMA, SCIDB_LE_WRONG_ATTRIBUTE_TYPE)
+                        << srcAttr.getName() << srcAttr.getType() << dstAttr.getType();
+                    }
+                    if (!dstAttr.isNullable() && srcAttr.isNullable())
+                    {
+                        throw USER_EXCEPTION(SCIDB_SE_INFER_SCHEMA, SCIDB_LE_WRONG_ATTRIBUTE_FLAGS)
+                        << srcAttr.getName();
+                    }
+                    if (!srcAttr.isEmptyIndicator())
+                    {
+                        ++numPreservedAttributes;
+                    }
+                    goto NextAttr;
+                }
+            }
+            for (const DimensionDesc &srcDim : srcDesc.getDimensions())
+            {
+                if (srcDim.hasNameAndAlias(dstAttr.getName()))
+                {
+                    if (dstAttr.getType() != TID_INT64)
+                    {
+                        throw USER_EXCEPTION(SCIDB_SE_INFER_SCHEMA, SCIDB_LE_WRONG_DESTINATION_ATTRIBUTE_TYPE)
+                        << dstAttr.getName() << TID_INT64;
+                    }
+                    goto NextAttr;
+                }
+            }
+            if (dstAttr.isEmptyIndicator() == false)
+            {
+                throw USER_EXCEPTION(SCIDB_SE_INFER_SCHEMA, SCIDB_LE_UNEXPECTED_DESTINATION_ATTRIBUTE)
+                << dstAttr.getName();
+            }
+        NextAttr:;
+        }
         return outSchema;
     }
 };
@@ -0,0 +1,66 @@
+/*
+**
+* BEGIN_COPYRIGHT
+*
+* Copyright (C) 2008-2016 SciDB, Inc.
+* All Rights Reserved.
+*
+* faster_redimension is a plugin for SciDB, an Open Source Array DBMS maintained
+* by Paradigm4. See http://www.paradigm4.com/
+*
+* faster_redimension is free software: you can redistribute it and/or modify
+* it under the terms of the AFFERO GNU General Public License as published by
+* the Free Software Foundation.
+*
+* faster_redimension is distributed "AS-IS" AND WITHOUT ANY WARRANTY OF ANY KIND,
+* INCLUDING ANY IMPLIED WARRANTY OF MERCHANTABILITY,
+* NON-INFRINGEMENT, OR FITNESS FOR A PARTICULAR PURPOSE. See
+* the AFFERO GNU General Public License for the complete license terms.
+*
+* You should have received a copy of the AFFERO GNU General Public License
+* along with faster_redimension.  If not, see <http://www.gnu.org/licenses/agpl-3.0.html>
+*
+* END_COPYRIGHT
+*/
+
+#include "query/Operator.h"
+#include "RedimStats.h"
+
+namespace scidb
+{
+
+using namespace std;
+using faster_redimension::RedimStats;
+
+/*
+ * faster_redimension_stats(): the phase counters of the last faster_redimension that ran on each instance, one row
+ * per counter (see RedimStats::getRows), at instance_id = the instance
+ */
+class LogicalFasterRedimensionStats : public LogicalOperator
+{
+public:
+    LogicalFasterRedimensionStats(const string& logicalName, const string& alias):
+        LogicalOperator(logicalName, alias)
+    {}
+
+    ArrayDesc inferSchema(vector< ArrayDesc> schemas, shared_ptr< Query> query)
+    {
+        size_t const numInstances = query->getInstancesCount();
+        Attributes outputAttributes;
+        outputAttributes.push_back(AttributeDesc(0, "name",    TID_STRING, 0, 0));
+        outputAttributes.push_back(AttributeDesc(1, "wall_ms", TID_DOUBLE, 0, 0));
+        outputAttributes.push_back(AttributeDesc(2, "cpu_ms",  TID_DOUBLE, 0, 0));
+        outputAttributes.push_back(AttributeDesc(3, "tuples",  TID_UINT64, 0, 0));
+        outputAttributes.push_back(AttributeDesc(4, "bytes",   TID_UINT64, 0, 0));
+        outputAttributes.push_back(AttributeDesc(5, "chunks",  TID_UINT64, 0, 0));
+        outputAttributes.push_back(AttributeDesc(6, DEFAULT_EMPTY_TAG_ATTRIBUTE_NAME, TID_INDICATOR, AttributeDesc::IS_EMPTY_INDICATOR, 0));
+        Dimensions outputDimensions;
+        outputDimensions.push_back(DimensionDesc("instance_id", 0, numInstances-1,                                1, 0));
+        outputDimensions.push_back(DimensionDesc("n",           0, RedimStats::getNumRows(numInstances)-1, RedimStats::getNumRows(numInstances), 0));
+        return ArrayDesc("faster_redimension_stats", outputAttributes, outputDimensions, createDistribution(psUndefined), query->getDefaultArrayResidency());
+    }
+};
+
+REGISTER_LOGICAL_OPERATOR_FACTORY(LogicalFasterRedimensionStats, "faster_redimension_stats");
+
+} //namespace scidb
@@ -0,0 +1,246 @@
+/*
+**
+* BEGIN_COPYRIGHT
+*
+* Copyright (C) 2008-2016 SciDB, Inc.
+* All Rights Reserved.
+*
+* faster_redimension is a plugin for SciDB, an Open Source Array DBMS maintained
+* by Paradigm4. See http://www.paradigm4.com/
+*
+* faster_redimension is free software: you can redistribute it and/or modify
+* it under the terms of the AFFERO GNU General Public License as published by
+* the Free Software Foundation.
+*
+* faster_redimension is distributed "AS-IS" AND WITHOUT ANY WARRANTY OF ANY KIND,
+* INCLUDING ANY IMPLIED WARRANTY OF MERCHANTABILITY,
+* NON-INFRINGEMENT, OR FITNESS FOR A PARTICULAR PURPOSE. See
+* the AFFERO GNU General Public License for the complete license terms.
+*
+* You should have received a copy of the AFFERO GNU General Public License
+* along with faster_redimension.  If not, see <http://www.gnu.org/licenses/agpl-3.0.html>
+*
+* END_COPYRIGHT
+*/
+
+#ifndef MEMORYGOVERNOR_H_
+#define MEMORYGOVERNOR_H_
+
+#include <atomic>
+#include "FasterRedimensionSettings.h"
+
+namespace scidb
+{
+namespace faster_redimension
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+ * Revisits the chunk size limits as the query runs when memory_budget_bytes is given. Settings derives them once,
+ * from a guessed tuple size and fixed fractions of the budget; the governor is asked again each time a sort run, sort
+ * chunk or SG chunk is started, and answers from the tuple sizes the scan has actually seen and from the memory in
+ * use at that moment. Memory in use is what the operator arena holds (the SciDB sort) plus what the operator's own
+ * heap buffers have reserved - sort runs, scatter blobs, SG chunks and scratch, staged output chunks - through a
+ * MemoryReservation each:
+ *  - sort runs: an equal share, among the runs being sorted and the one being filled, of what is free plus what
+ *    the sorter already holds, and no more than the static limit
+ *  - sort chunks: a quarter of the budget still free, and no more than the static limit
+ *  - SG chunks: the budget still free split across the fan-in - each receiving instance holds a chunk from every
+ *    instance - kept within [MIN_SG_CHUNK, MAX_SG_CHUNK] but never under MIN_TUPLES_PER_CHUNK observed tuples, and
+ *    rounded down to a power of two
+ * Without a budget, and for any limit set explicitly, the Settings value stands; reservations are still counted,
+ * for the peak that faster_redimension_stats() reports.
+ */
+class MemoryGovernor : public boost::noncopyable
+{
+private:
+    static size_t const MIN_SG_CHUNK         = 128 * 1024;
+    static size_t const MAX_SG_CHUNK         = 10 * 1024 * 1024; //sending messages that are too large may make things unstable
+    static size_t const MIN_SORT_CHUNK       = 128 * 1024;
+    static size_t const MIN_TUPLES_PER_CHUNK = 64;
+
+    Settings const&        _settings;
+    arena::ArenaPtr const  _arena;
+    bool const             _enabled;
+    size_t const           _budget;
+    size_t const           _fanIn;
+    std::atomic<uint64_t>  _tuplesSeen;
+    std::atomic<uint64_t>  _bytesSeen;
+    std::atomic<size_t>    _minAvailable;
+    std::atomic<size_t>    _reserved;
+    std::atomic<size_t>    _peakReserved;
+
+    //The budget minus what is in use, but at least a sixteenth of it so the limits never collapse
+    size_t getAvailable()
+    {
+        size_t const used = getUsed();
+        size_t const result = (used + _budget / 16 < _budget) ? _budget - used : _budget / 16;
+        if(result < _minAvailable)
+        {
+            _minAvailable = result;
+        }
+        return result;
+    }
+
+public:
+    MemoryGovernor(Settings const& settings, arena::ArenaPtr const& arena, size_t const fanIn):
+        _settings(settings),
+        _arena(arena),
+        _enabled(settings.haveMemoryBudget()),
+        _budget(settings.getMergeSortBufferSize()),
+        _fanIn(std::max<size_t>(fanIn, 1)),
+        _tuplesSeen(0),
+        _bytesSeen(0),
+        _minAvailable(settings.getMergeSortBufferSize()),
+        _reserved(0),
+        _peakReserved(0)
+    {}
+
+    ~MemoryGovernor()
+    {
+        LOG4CXX_DEBUG(logger, "FR memory governor budget "<<_budget<<" least available "<<_minAvailable<<" peak reserved "<<_peakReserved
+                      <<" tuples seen "<<_tuplesSeen<<" average tuple size "<<getTupleSize());
+    }
+
+    //Called by ArrayReader<READ_INPUT> once per block with the number of tuples it made and their total encoded size
+    void observeTuples(size_t const numTuples, size_t const numBytes)
+    {
+        _tuplesSeen += numTuples;
+        _bytesSeen += numBytes;
+    }
+
+    //The average tuple seen so far, or the Settings estimate before any
+    size_t getTupleSize() const
+    {
+        uint64_t const tuples = _tuplesSeen;
+        return tuples ? std::max<size_t>(_bytesSeen / tuples, 1) : _settings.getEstTupleSize();
+    }
+
+    //Heap bytes taken or given back by one of the operator's buffers; see MemoryReservation
+    void reserve(size_t const bytes)
+    {
+        size_t const reserved = (_reserved += bytes);
+        size_t peak = _peakReserved;
+        while(reserved > peak && !_peakReserved.compare_exchange_weak(peak, reserved))
+        {}
+    }
+
+    void release(size_t const bytes)
+    {
+        _reserved -= bytes;
+    }
+
+    size_t getUsed() const
+    {
+        return (_arena ? _arena->allocated() : 0) + _reserved;
+    }
+
+    //The most the operator held at once: the arena peak plus the reservations peak, which may not have coincided
+    size_t getPeakUsed() const
+    {
+        return (_arena ? _arena->peakusage() : 0) + _peakReserved;
+    }
+
+    //For a run sorter that holds heldBytes in runs already and sorts numThreads runs while filling the next
+    size_t getRunSizeLimit(size_t const staticLimit, size_t const numThreads, size_t const heldBytes)
+    {
+        if(!_enabled)
+        {
+            return staticLimit;
+        }
+        return std::max(std::min(staticLimit, (getAvailable() + heldBytes) / (numThreads + 1)), (size_t) MIN_SORT_CHUNK);
+    }
+
+    size_t getSortChunkSizeLimit()
+    {
+        size_t const limit = _settings.getSortChunkSizeLimit();
+        if(!_enabled || _settings.sortChunkSizeLimitSet())
+        {
+            return limit;
+        }
+        return std::max(std::min(limit, getAvailable() / 4), (size_t) MIN_SORT_CHUNK);
+    }
+
+    size_t getSgChunkSizeLimit()
+    {
+        if(!_enabled || _settings.sgChunkSizeLimitSet())
+        {
+            return _settings.getSgChunkSizeLimit();
+        }
+        size_t result = std::min(std::max(getAvailable() / _fanIn, (size_t) MIN_SG_CHUNK), (size_t) MAX_SG_CHUNK);
+        result = std::max(result, MIN_TUPLES_PER_CHUNK * getTupleSize());
+        size_t rounded = MIN_SG_CHUNK; //round down to a power of two so the SG chunk is not reallocated for small changes
+        while(rounded * 2 <= result)
+        {
+            rounded *= 2;
+        }
+        return rounded;
+    }
+};
+
+/*
+ * The bytes one heap buffer holds, reserved with the MemoryGovernor (if any) and given back when it goes. update()
+ * is meant to be called as the buffer grows; it reserves RESERVATION_STEP ahead and only touches the governor again
+ * once the buffer outgrows that or shrinks by two steps, so it is cheap enough to call per tuple and the reservation
+ * is never below what the buffer holds.
+ */
+class MemoryReservation : public boost::noncopyable
+{
+private:
+    static size_t const RESERVATION_STEP = 64 * 1024;
+
+    MemoryGovernor* _governor;
+    size_t          _bytes;
+
+public:
+    explicit MemoryReservation(MemoryGovernor* governor = NULL):
+        _governor(governor),
+        _bytes(0)
+    {}
+
+    ~MemoryReservation()
+    {
+        set(0);
+    }
+
+    void setGovernor(MemoryGovernor* governor)
+    {
+        set(0);
+        _governor = governor;
+    }
+
+    void set(size_t const bytes)
+    {
+        if(_governor)
+        {
+            if(bytes > _bytes)
+            {
+                _governor->reserve(bytes - _bytes);
+            }
+            else
+            {
+                _governor->release(_bytes - bytes);
+            }
+        }
+        _bytes = bytes;
+    }
+
+    void update(size_t const bytes)
+    {
+        if(bytes > _bytes || bytes + 2 * RESERVATION_STEP <= _bytes)
+        {
+            set(bytes + RESERVATION_STEP);
+        }
+    }
+
+    size_t getBytes() const
+    {
+        return _bytes;
+    }
+};
+
+} } //namespaces
+
+#endif /* MEMORYGOVERNOR_H_ */
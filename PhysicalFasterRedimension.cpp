@@ -26,8 +26,12 @@
 #include <query/Operator.h>
 #include <array/SortArray.h>
 #include <array/RLE.h>
+#include <LZBlock/LZBlock.h>
 #include "FasterRedimensionSettings.h"
 #include "ArrayIO.h"
+#include "TupleSort.h"
+#include "MemoryGovernor.h"
+#include "AutoChunk.h"
 
 namespace scidb
 {
@@ -40,32 +44,42 @@ namespace faster_redimension
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 /*
- * This is a delegate-style array for reading the input into the sort. It wraps around ArrayReader<READ_INPUT>
- * and only implements the methods that the sort needs. It also makes sure no chunk passed to sort exceeds
- * a binary size limit. Written out upside-down.
+ * This is a delegate-style array for reading the input into the sort. It wraps around ArrayReader<READ_INPUT> - the
+ * first run, already read to check for presorted input, is replayed before it - and only implements the methods
+ * that the sort needs. It also makes sure no chunk passed to sort exceeds a binary size limit, asked of the
+ * MemoryGovernor for each chunk; the reader tells the governor how big the tuples are. Written out upside-down.
  * InputScannerChunkIterator
  * InputScannerChunk
  * InputScannerArrayIterator
  * InputScannerArray
  */
+typedef RunReplaySource<ArrayReader<READ_INPUT> > InputTupleSource;
+
 class InputScannerChunkIterator : public ConstChunkIterator
 {
 private:
-    ArrayReader<READ_INPUT>& _reader;
+    InputTupleSource& _reader;
+    RedimStats& _stats;
     size_t const _binaryChunkSizeLimit;
     size_t _cellsRead;
     size_t _bytesRead;
     Coordinates _pos;
 
 public:
-    InputScannerChunkIterator(ArrayReader<READ_INPUT>& reader, size_t binaryChunkSizeLimit):
+    InputScannerChunkIterator(InputTupleSource& reader, MemoryGovernor& governor, RedimStats& stats):
         _reader(reader),
-        _binaryChunkSizeLimit(binaryChunkSizeLimit),
+        _stats(stats),
+        _binaryChunkSizeLimit(governor.getSortChunkSizeLimit()),
         _cellsRead(0),
         _bytesRead(0),
         _pos(1,0)
     {}
 
+    ~InputScannerChunkIterator()
+    {
+        _stats.add(PHASE_SORT, _cellsRead, _bytesRead, 1);
+    }
+
     virtual bool isEmpty() const
     {
         return false;
@@ -104,18 +118,20 @@ public:
 class InputScannerChunk : public ConstChunk
 {
 private:
-    ArrayReader<READ_INPUT>& _reader;
-    size_t const _binaryChunkSizeLimit;
+    InputTupleSource& _reader;
+    MemoryGovernor& _governor;
+    RedimStats& _stats;
 
 public:
-    InputScannerChunk(ArrayReader<READ_INPUT>&  reader, size_t binaryChunkSizeLimit):
+    InputScannerChunk(InputTupleSource&  reader, MemoryGovernor& governor, RedimStats& stats):
         _reader(reader),
-        _binaryChunkSizeLimit(binaryChunkSizeLimit)
+        _governor(governor),
+        _stats(stats)
     {}
 
     virtual shared_ptr<ConstChunkIterator> getConstIterator(int iterationMode) const
     {
-        return shared_ptr<ConstChunkIterator>(new InputScannerChunkIterator(_reader, _binaryChunkSizeLimit));
+        return shared_ptr<ConstChunkIterator>(new InputScannerChunkIterator(_reader, _governor, _stats));
     }
 
     virtual const ArrayDesc& getArrayDesc() const                              { throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "illegal array chunk getArrayDesc call"; }
@@ -129,17 +145,15 @@ public:
 class InputScannerArrayIterator : public ConstArrayIterator
 {
 private:
-    ArrayReader<READ_INPUT>& _reader;
+    InputTupleSource& _reader;
     InputScannerChunk _chunk;
     Coordinates _pos;
-    size_t const _binaryChunkSizeLimit;
 
 public:
-    InputScannerArrayIterator(ArrayReader<READ_INPUT>& reader, size_t binaryChunkSizeLimit):
+    InputScannerArrayIterator(InputTupleSource& reader, MemoryGovernor& governor, RedimStats& stats):
         _reader(reader),
-        _chunk(_reader, binaryChunkSizeLimit),
-        _pos(1,0),
-        _binaryChunkSizeLimit(binaryChunkSizeLimit)
+        _chunk(_reader, governor, stats),
+        _pos(1,0)
     {}
 
     virtual ConstChunk const& getChunk()
@@ -169,14 +183,19 @@ class InputScannerArray : public Array
 {
 private:
     ArrayDesc _desc;
-    mutable ArrayReader<READ_INPUT> _reader;
-    size_t const _binaryChunkSizeLimit;
+    shared_ptr<ArrayReader<READ_INPUT> > _input;
+    mutable InputTupleSource _reader;
+    MemoryGovernor& _governor;
+    RedimStats& _stats;
 
 public:
-    InputScannerArray(shared_ptr<Array>& inputArray, Settings const& settings,  shared_ptr<Query>& query):
+    InputScannerArray(shared_ptr<ArrayReader<READ_INPUT> > const& input, shared_ptr<TupleRun> firstRun, Settings const& settings,
+                      shared_ptr<Query>& query, MemoryGovernor& governor):
         _desc(settings.makePreSortSchema(query)),
-        _reader(inputArray, settings),
-        _binaryChunkSizeLimit(settings.getSortChunkSizeLimit())
+        _input(input),
+        _reader(std::move(firstRun), *_input),
+        _governor(governor),
+        _stats(settings.getStats())
     {}
 
     virtual ArrayDesc const& getArrayDesc() const
@@ -191,7 +210,7 @@ public:
 
     virtual std::shared_ptr<ConstArrayIterator> getConstIterator(AttributeID attr) const
     {
-        return shared_ptr<ConstArrayIterator>(new InputScannerArrayIterator(_reader, _binaryChunkSizeLimit));
+        return shared_ptr<ConstArrayIterator>(new InputScannerArrayIterator(_reader, _governor, _stats));
     }
 };
 
@@ -199,10 +218,61 @@ public:
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 /*
- * Now, to avoid excessive chunkIterator::writeItem calls we pack the RedimensionTuples into large binary blobs:
+ * Now, to avoid excessive chunkIterator::writeItem calls we pack the RedimensionTuples into large binary blobs.
+ * Every blob starts with a uint32 format tag. With sg_format=tuples (SG_BLOB_TUPLES) it continues as:
  * [uint32 size][tuple][uint32 size][tuple]...[uint32 size][tuple][uint32 0]
  * Note the use of 0 as the terminator.
+ * With sg_format=columnar (SG_BLOB_COLUMNAR) the same tuples are stored one column at a time:
+ * [uint32 nTuples][key][key]...[key] then, for every attribute:
+ * ([int8 missing_code] x nTuples) ([data] x nTuples | [uint32 offset] x (nTuples+1) [data][data]...)
+ * missing codes are only present for nullable attributes; fixed-size columns keep their stride and leave null
+ * cells zeroed; variable-size columns carry nTuples+1 offsets into the data that follows them.
+ * With sg_format=delta (SG_BLOB_DELTA) tuples that share instance and chunk - all but a few in a sorted blob - are
+ * grouped and the key prefix is written once per group:
+ * [uint32 nTuples] then groups of [ndims, instance and chunk coordinates as in the key][uint32 nGroupTuples]
+ * ([varint position delta][varint values size][values]) x nGroupTuples
+ * Positions ascend within a group; the first delta is from 0.
+ * When the redimension only remaps coordinates (Settings::isDimensionOnly) all tuples have the same size and,
+ * unless sg_format=delta, they go out as SG_BLOB_FIXED: [uint32 nTuples][tuple][tuple]...[tuple]
+ * With sg_compression=lz any of these may be sent as [uint32 format | SG_BLOB_COMPRESSED][uint32 size][compressed]
+ * where size is that of everything after the format tag, before compression.
  */
+enum SgBlobFormat
+{
+    SG_BLOB_TUPLES     = 1,
+    SG_BLOB_FIXED      = 2,
+    SG_BLOB_DELTA      = 3,
+    SG_BLOB_COLUMNAR   = 0x100,
+    SG_BLOB_COMPRESSED = 0x80000000u
+};
+
+//LEB128: 7 bits per byte, low bits first, high bit set on all but the last byte
+static size_t const MAX_VARINT_SIZE = 10;
+
+static char* writeVarint(char* ptr, uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        *ptr++ = static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    *ptr++ = static_cast<char>(value);
+    return ptr;
+}
+
+static char const* readVarint(char const* ptr, uint64_t& value)
+{
+    value = 0;
+    for(size_t shift = 0; ; shift += 7)
+    {
+        uint8_t const byte = static_cast<uint8_t>(*ptr++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if((byte & 0x80) == 0)
+        {
+            return ptr;
+        }
+    }
+}
 
 //Distance between chunk start and the data region (for a chunk with a single binary blob)
 static size_t getChunkOverheadSize()
@@ -218,9 +288,153 @@ static size_t getSizeOffset()
     return getChunkOverheadSize()-4;
 }
 
+//Allocate a chunk for one binary blob of up to binaryChunkSizeLimit bytes and write its RLE header; returns the size pointer
+static uint32_t* initSgChunk(MemChunk& chunk, size_t const binaryChunkSizeLimit, char const* owner)
+{
+    try
+    {
+        chunk.allocate(getChunkOverheadSize() + binaryChunkSizeLimit);
+    }
+    catch(...)
+    {
+        throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << owner << " cannot allocate memory";
+    }
+    char* bufPointer = (char*) chunk.getData();
+    ConstRLEPayload::Header* hdr = (ConstRLEPayload::Header*) bufPointer;
+    hdr->_magic = RLE_PAYLOAD_MAGIC;
+    hdr->_nSegs = 1;
+    hdr->_elemSize = 0;
+    hdr->_dataSize = binaryChunkSizeLimit + 5 + sizeof(varpart_offset_t);
+    hdr->_varOffs = sizeof(varpart_offset_t);
+    hdr->_isBoolean = 0;
+    ConstRLEPayload::Segment* seg = (ConstRLEPayload::Segment*) (hdr+1);
+    *seg =  ConstRLEPayload::Segment(0,0,false,false);
+    ++seg;
+    *seg =  ConstRLEPayload::Segment(1,0,false,false);
+    varpart_offset_t* vp =  reinterpret_cast<varpart_offset_t*>(seg+1);
+    *vp = 0;
+    uint8_t* sizeFlag = reinterpret_cast<uint8_t*>(vp+1);
+    *sizeFlag =0;
+    uint32_t* sizePointer = reinterpret_cast<uint32_t*> (sizeFlag + 1);
+    *sizePointer = static_cast<uint32_t>(binaryChunkSizeLimit);
+    return sizePointer;
+}
+
 /*
- * Wrap around ArrayReader<READ_TUPLED> and output the sg schema chunks with tuples packed into blobs - ready for SG.
+ * Applies sg_compression to the blobs of one SG array. Blobs are packed into a chunk of the full size limit; a blob
+ * that compresses is written to a chunk reallocated to just its compressed size, so that only those bytes travel,
+ * and the next blob gets a full-size chunk again. Blobs that do not get smaller go out as they are. Keeps totals and
+ * logs the ratio achieved when the array is done.
+ * The size limit is asked of the MemoryGovernor before each blob; the chunk is reallocated when it changes. The chunk
+ * and the scratch buffer are reserved with the governor.
  */
+class SgBlobCompressor : public boost::noncopyable
+{
+private:
+    bool const      _enabled;
+    MemoryGovernor& _governor;
+    size_t          _binaryChunkSizeLimit;
+    char const*     _owner;
+    vector<char> _scratch;
+    bool         _shrunk;
+    uint64_t     _numBlobs;
+    uint64_t     _numCompressed;
+    uint64_t     _rawBytes;
+    uint64_t     _sentBytes;
+    MemoryReservation _memory;
+
+public:
+    SgBlobCompressor(Settings const& settings, MemoryGovernor& governor, char const* owner):
+        _enabled(settings.getSgCompression() == SG_COMPRESSION_LZ),
+        _governor(governor),
+        _binaryChunkSizeLimit(governor.getSgChunkSizeLimit()),
+        _owner(owner),
+        _shrunk(false),
+        _numBlobs(0),
+        _numCompressed(0),
+        _rawBytes(0),
+        _sentBytes(0),
+        _memory(&governor)
+    {
+        _memory.set(_binaryChunkSizeLimit);
+    }
+
+    ~SgBlobCompressor()
+    {
+        if(_enabled && _rawBytes > 0)
+        {
+            LOG4CXX_DEBUG(logger, "FR "<<_owner<<" compressed "<<_numCompressed<<" of "<<_numBlobs<<" blobs, "
+                          <<_rawBytes<<" bytes to "<<_sentBytes<<", ratio "<<(double) _rawBytes / _sentBytes);
+        }
+    }
+
+    //The first chunk: allocate it at the current limit and return its size pointer
+    uint32_t* init(MemChunk& chunk)
+    {
+        return initSgChunk(chunk, _binaryChunkSizeLimit, _owner);
+    }
+
+    size_t getLimit() const
+    {
+        return _binaryChunkSizeLimit;
+    }
+
+    //Call before packing a blob: returns the size pointer of a full-size chunk, of at least minSize bytes
+    uint32_t* prepare(MemChunk& chunk, uint32_t* sizePointer, size_t const minSize = 0)
+    {
+        size_t const limit = _governor.getSgChunkSizeLimit();
+        if(_shrunk || limit != _binaryChunkSizeLimit || minSize > _binaryChunkSizeLimit)
+        {
+            _shrunk = false;
+            _binaryChunkSizeLimit = std::max(limit, minSize);
+            _memory.set(_binaryChunkSizeLimit + _scratch.capacity());
+            return initSgChunk(chunk, _binaryChunkSizeLimit, _owner);
+        }
+        return sizePointer;
+    }
+
+    //Call after packing dataSize bytes, format tag included, behind sizePointer: returns the size to send
+    size_t compress(MemChunk& chunk, uint32_t*& sizePointer, size_t const dataSize)
+    {
+        ++_numBlobs;
+        _rawBytes += dataSize;
+        size_t const payloadSize = dataSize - sizeof(uint32_t);
+        if(!_enabled || payloadSize <= 2 * sizeof(uint32_t))
+        {
+            _sentBytes += dataSize;
+            return dataSize;
+        }
+        size_t const capacity = payloadSize - sizeof(uint32_t) - 1;
+        _scratch.resize(capacity);
+        _memory.update(_binaryChunkSizeLimit + _scratch.capacity());
+        size_t const compressedSize = LZBlock_compress(reinterpret_cast<char const*>(sizePointer + 2), &_scratch[0], payloadSize, capacity);
+        if(compressedSize == 0)
+        {
+            _sentBytes += dataSize;
+            return dataSize;
+        }
+        uint32_t const format = sizePointer[1] | SG_BLOB_COMPRESSED;
+        uint32_t const rawSize = static_cast<uint32_t>(payloadSize);
+        size_t const result = 2 * sizeof(uint32_t) + compressedSize;
+        sizePointer = initSgChunk(chunk, result, _owner);
+        sizePointer[1] = format;
+        sizePointer[2] = rawSize;
+        memcpy(sizePointer + 3, &_scratch[0], compressedSize);
+        _shrunk = true;
+        ++_numCompressed;
+        _sentBytes += result;
+        return result;
+    }
+};
+
+/*
+ * Wrap around a sorted tuple source and output the sg schema chunks with tuples packed into blobs - ready for SG.
+ * The source is ArrayReader<READ_TUPLED> over the sort output, or TupleRunMerger or PipelinedTupleSorter over the
+ * runs. With aggregate=... the tuples that follow a packed tuple at the same position are combined into its states
+ * where it was packed, so that each position crosses the SG once per instance. Tuples that do not collide are
+ * packed straight from the source; only the states of a colliding group are touched.
+ */
+template <class TupleSource>
 class TupleSgArray : public SinglePassArray
 {
 private:
@@ -230,22 +444,314 @@ private:
     Coordinates _posBuf;
     MemChunk _chunk;
     std::weak_ptr<Query> _query;
-    size_t const _binaryChunkSizeLimit;
-    size_t const _chunkOverheadSize;
-    ArrayReader<READ_TUPLED> _reader;
+    Settings const& _settings;
+    size_t _binaryChunkSizeLimit;
+    size_t const _keySize;
+    size_t const _fixedTupleSize;
+    shared_ptr<TupleSource> _source;
+    TupleSource& _reader;
     char* _bufPointer;
     uint32_t* _sizePointer;
+    vector<char> _keyColumn;                 //columnar: the blob's columns as they fill; kept from blob to blob
+    vector<vector<int8_t> > _missingColumns;
+    vector<vector<char> > _dataColumns;
+    vector<vector<uint32_t> > _offsetColumns;
+    vector<AttributeView> _views;
+    SgBlobCompressor _compressor;
+    size_t _blobTuples;
+    bool const _combine;                     //aggregate=...
+    vector<char> _key;                       //delta: the key of the tuple just packed
+    vector<AttributeView> _otherViews;
+    size_t _numCombined;
+
+    bool readerOnCurrentInstance() const
+    {
+        return !_reader.end() && RedimTuple::getInstanceId(_reader.getTuple()) == _chunkAddress.coords[1];
+    }
+
+    /*
+     * Move past the tuple just packed, whose key is at key, and with aggregate=... past the tuples that follow at the
+     * same position, combining them into its states. packed is where the tuple was packed, laid out as a tuple from
+     * its values on (the key bytes are not read), or NULL for the last row of the columnar blob.
+     */
+    void advance(char const* key, char* packed)
+    {
+        _reader.next();
+        if(!_combine)
+        {
+            return;
+        }
+        vector<AggregateSpec> const& aggregates = _settings.getAggregates();
+        bool viewed = false;
+        while(!_reader.end() && memcmp(_reader.getTuple()->data(), key, _keySize) == 0)
+        {
+            if(!viewed)
+            {
+                viewPacked(packed);
+                viewed = true;
+            }
+            view(static_cast<char const*>(_reader.getTuple()->data()), _otherViews);
+            for(size_t k=0; k<aggregates.size(); ++k)
+            {
+                size_t const o = aggregates[k].outputAttr;
+                Aggregates::combine(aggregates[k], const_cast<char*>(_views[o].data), _otherViews[o].data); //in our blob
+            }
+            ++_numCombined;
+            _reader.next();
+        }
+    }
+
+    void view(char const* tuple, vector<AttributeView>& views) const
+    {
+        RedimTuple::viewAttributes(_settings.getNumOutputDims(),
+                                   _settings.getNumOutputAttrs(),
+                                   _settings.outputAttributeNullable(),
+                                   _settings.getOutputAttributeSizes(),
+                                   tuple,
+                                   views);
+    }
+
+    //Point _views at the states of the tuple just packed; in the columnar blob those end their data columns
+    void viewPacked(char* packed)
+    {
+        if(packed)
+        {
+            view(packed, _views);
+            return;
+        }
+        vector<AggregateSpec> const& aggregates = _settings.getAggregates();
+        vector<size_t> const& sizes = _settings.getOutputAttributeSizes();
+        for(size_t k=0; k<aggregates.size(); ++k)
+        {
+            size_t const o = aggregates[k].outputAttr;
+            _views[o].data = &_dataColumns[o][_dataColumns[o].size() - sizes[o]];
+        }
+    }
+
+    size_t packTuples()
+    {
+        size_t dataSize = sizeof(uint32_t);
+        while(readerOnCurrentInstance() && (dataSize + _reader.getTuple()->size() + 2*sizeof(uint32_t)) < _binaryChunkSizeLimit)
+        {
+            Value const* tuple = _reader.getTuple();
+            uint32_t const tupleSize = tuple->size();
+            uint32_t* sizePtr = reinterpret_cast<uint32_t*>(_bufPointer);
+            dataSize += (tupleSize + sizeof(uint32_t));
+            *sizePtr = tupleSize;
+            ++sizePtr;
+            _bufPointer = reinterpret_cast<char*>(sizePtr);
+            memcpy(_bufPointer, tuple->data(), tupleSize);
+            _bufPointer += tupleSize;
+            ++_blobTuples;
+            advance(_bufPointer - tupleSize, _bufPointer - tupleSize);
+        }
+        if(dataSize == sizeof(uint32_t))
+        {
+            return 0;
+        }
+        uint32_t* terminatorPtr = reinterpret_cast<uint32_t*>(_bufPointer);
+        *terminatorPtr = 0;
+        dataSize += sizeof(uint32_t);
+        return dataSize;
+    }
+
+    size_t packFixed()
+    {
+        char* writePtr = _bufPointer + sizeof(uint32_t);
+        size_t const maxTuples = (_binaryChunkSizeLimit - 2 * sizeof(uint32_t)) / _fixedTupleSize;
+        uint32_t nTuples = 0;
+        while(nTuples < maxTuples && readerOnCurrentInstance())
+        {
+            memcpy(writePtr, _reader.getTuple()->data(), _fixedTupleSize);
+            writePtr += _fixedTupleSize;
+            ++nTuples;
+            advance(writePtr - _fixedTupleSize, writePtr - _fixedTupleSize);
+        }
+        if(nTuples == 0)
+        {
+            return 0;
+        }
+        memcpy(_bufPointer, &nTuples, sizeof(uint32_t));
+        _blobTuples = nTuples;
+        return writePtr - _bufPointer + sizeof(uint32_t);
+    }
+
+    size_t packDelta()
+    {
+        size_t const prefixSize = _keySize - sizeof(position_t);
+        char* writePtr = _bufPointer + sizeof(uint32_t);
+        char const* groupPrefix = NULL;
+        uint32_t* groupCount = NULL;
+        position_t previous = 0;
+        uint32_t nTuples = 0;
+        while(readerOnCurrentInstance())
+        {
+            Value const* tuple = _reader.getTuple();
+            char const* data = reinterpret_cast<char const*>(tuple->data());
+            size_t const valuesSize = tuple->size() - _keySize;
+            bool const newGroup = (groupPrefix == NULL || memcmp(groupPrefix, data, prefixSize) != 0);
+            size_t const maxSize = (newGroup ? prefixSize + sizeof(uint32_t) : 0) + 2 * MAX_VARINT_SIZE + valuesSize;
+            if((writePtr - _bufPointer) + maxSize + sizeof(uint32_t) >= _binaryChunkSizeLimit)
+            {
+                break;
+            }
+            if(newGroup)
+            {
+                memcpy(writePtr, data, prefixSize);
+                groupPrefix = writePtr;
+                writePtr += prefixSize;
+                groupCount = reinterpret_cast<uint32_t*>(writePtr);
+                *groupCount = 0;
+                writePtr += sizeof(uint32_t);
+                previous = 0;
+            }
+            uint64_t encodedPosition;
+            memcpy(&encodedPosition, data + prefixSize, sizeof(uint64_t));
+            position_t const position = RedimTuple::decodeCoordinate(encodedPosition);
+            writePtr = writeVarint(writePtr, position - previous);
+            previous = position;
+            writePtr = writeVarint(writePtr, valuesSize);
+            memcpy(writePtr, data + _keySize, valuesSize);
+            writePtr += valuesSize;
+            ++(*groupCount);
+            ++nTuples;
+            if(_combine)
+            {
+                memcpy(&_key[0], data, _keySize);
+            }
+            advance(&_key[0], writePtr - valuesSize - _keySize);
+        }
+        if(nTuples == 0)
+        {
+            return 0;
+        }
+        memcpy(_bufPointer, &nTuples, sizeof(uint32_t));
+        _blobTuples = nTuples;
+        return writePtr - _bufPointer + sizeof(uint32_t);
+    }
+
+    size_t packColumnar()
+    {
+        size_t const nAttrs = _settings.getNumOutputAttrs();
+        vector<bool> const& nullable = _settings.outputAttributeNullable();
+        vector<size_t> const& sizes = _settings.getOutputAttributeSizes();
+        size_t dataSize = 2 * sizeof(uint32_t);
+        _keyColumn.clear();
+        for(size_t i=0; i<nAttrs; ++i)
+        {
+            _missingColumns[i].clear();
+            _dataColumns[i].clear();
+            _offsetColumns[i].clear();
+            if(sizes[i] == 0)
+            {
+                dataSize += sizeof(uint32_t); //the extra offset
+            }
+        }
+        size_t nTuples = 0;
+        while(readerOnCurrentInstance())
+        {
+            char const* tuple = reinterpret_cast<char const*>(_reader.getTuple()->data());
+            RedimTuple::viewAttributes(_settings.getNumOutputDims(), nAttrs, nullable, sizes, tuple, _views);
+            size_t rowSize = _keySize;
+            for(size_t i=0; i<nAttrs; ++i)
+            {
+                rowSize += (nullable[i] ? sizeof(int8_t) : 0) + (sizes[i] != 0 ? sizes[i] : sizeof(uint32_t) + _views[i].size);
+            }
+            if(dataSize + rowSize >= _binaryChunkSizeLimit)
+            {
+                break;
+            }
+            dataSize += rowSize;
+            _keyColumn.insert(_keyColumn.end(), tuple, tuple + _keySize);
+            for(size_t i=0; i<nAttrs; ++i)
+            {
+                AttributeView const& v = _views[i];
+                vector<char>& data = _dataColumns[i];
+                if(nullable[i])
+                {
+                    _missingColumns[i].push_back(v.missingReason);
+                }
+                if(sizes[i] != 0)
+                {
+                    if(v.missingReason >= 0)
+                    {
+                        data.resize(data.size() + sizes[i], 0);
+                    }
+                    else
+                    {
+                        data.insert(data.end(), v.data, v.data + sizes[i]);
+                    }
+                }
+                else
+                {
+                    _offsetColumns[i].push_back(static_cast<uint32_t>(data.size()));
+                    if(v.missingReason < 0)
+                    {
+                        data.insert(data.end(), v.data, v.data + v.size);
+                    }
+                }
+            }
+            ++nTuples;
+            advance(&_keyColumn[_keyColumn.size() - _keySize], NULL);
+        }
+        if(nTuples == 0)
+        {
+            return 0;
+        }
+        char* writePtr = _bufPointer;
+        uint32_t const n32 = static_cast<uint32_t>(nTuples);
+        _blobTuples = nTuples;
+        memcpy(writePtr, &n32, sizeof(uint32_t));
+        writePtr += sizeof(uint32_t);
+        memcpy(writePtr, &_keyColumn[0], _keyColumn.size());
+        writePtr += _keyColumn.size();
+        for(size_t i=0; i<nAttrs; ++i)
+        {
+            if(nullable[i])
+            {
+                memcpy(writePtr, &_missingColumns[i][0], nTuples);
+                writePtr += nTuples;
+            }
+            vector<char> const& data = _dataColumns[i];
+            if(sizes[i] == 0)
+            {
+                vector<uint32_t>& offsets = _offsetColumns[i];
+                offsets.push_back(static_cast<uint32_t>(data.size()));
+                memcpy(writePtr, &offsets[0], offsets.size() * sizeof(uint32_t));
+                writePtr += offsets.size() * sizeof(uint32_t);
+            }
+            if(data.size())
+            {
+                memcpy(writePtr, &data[0], data.size());
+                writePtr += data.size();
+            }
+        }
+        return writePtr - _bufPointer + sizeof(uint32_t);
+    }
 
 public:
-    TupleSgArray(shared_ptr<Array> & input, Settings const& settings, shared_ptr<Query>& query):
+    TupleSgArray(shared_ptr<TupleSource> const& source, Settings const& settings, shared_ptr<Query>& query, MemoryGovernor& governor):
         super(settings.makeSgSchema(query)),
         _rowIndex(0),
         _chunkAddress(0, Coordinates(3,0)),
         _posBuf(3,0),
         _query(query),
-        _binaryChunkSizeLimit(settings.getSgChunkSizeLimit()),
-        _chunkOverheadSize(getChunkOverheadSize()),
-        _reader(input, settings)
+        _settings(settings),
+        _binaryChunkSizeLimit(0),
+        _keySize(RedimTuple::getKeySize(settings.getNumOutputDims())),
+        _fixedTupleSize(settings.getFixedTupleSize()),
+        _source(source),
+        _reader(*_source),
+        _missingColumns(settings.getNumOutputAttrs()),
+        _dataColumns(settings.getNumOutputAttrs()),
+        _offsetColumns(settings.getNumOutputAttrs()),
+        _views(settings.getNumOutputAttrs()),
+        _compressor(settings, governor, "TupleSgArray"),
+        _blobTuples(0),
+        _combine(settings.haveAggregates()),
+        _key(_keySize),
+        _otherViews(settings.getNumOutputAttrs()),
+        _numCombined(0)
     {
         super::setEnforceHorizontalIteration(true);
         _chunkAddress.coords[0]=-1;
@@ -254,35 +760,19 @@ public:
         {
             _chunkAddress.coords[1] = RedimTuple::getInstanceId(_reader.getTuple());
         }
-        try
-        {
-            _chunk.allocate(_chunkOverheadSize + _binaryChunkSizeLimit);
-        }
-        catch(...)
-        {
-            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "TupleSgArray cannot allocate memory";
-        }
-        _bufPointer = (char*) _chunk.getData();
-        ConstRLEPayload::Header* hdr = (ConstRLEPayload::Header*) _bufPointer;
-        hdr->_magic = RLE_PAYLOAD_MAGIC;
-        hdr->_nSegs = 1;
-        hdr->_elemSize = 0;
-        hdr->_dataSize = _binaryChunkSizeLimit + 5 + sizeof(varpart_offset_t);
-        hdr->_varOffs = sizeof(varpart_offset_t);
-        hdr->_isBoolean = 0;
-        ConstRLEPayload::Segment* seg = (ConstRLEPayload::Segment*) (hdr+1);
-        *seg =  ConstRLEPayload::Segment(0,0,false,false);
-        ++seg;
-        *seg =  ConstRLEPayload::Segment(1,0,false,false);
-        varpart_offset_t* vp =  reinterpret_cast<varpart_offset_t*>(seg+1);
-        *vp = 0;
-        uint8_t* sizeFlag = reinterpret_cast<uint8_t*>(vp+1);
-        *sizeFlag =0;
-        _sizePointer = reinterpret_cast<uint32_t*> (sizeFlag + 1);
-        *_sizePointer = static_cast<uint32_t>(_binaryChunkSizeLimit);
+        _sizePointer = _compressor.init(_chunk);
+        _binaryChunkSizeLimit = _compressor.getLimit();
         _bufPointer = reinterpret_cast<char*> (_sizePointer+1);
     }
 
+    ~TupleSgArray()
+    {
+        if(_combine)
+        {
+            LOG4CXX_DEBUG(logger, "FR pre-combine merged "<<_numCombined<<" tuples before the SG");
+        }
+    }
+
     size_t getCurrentRowIndex() const
     {
         return _rowIndex;
@@ -294,35 +784,43 @@ public:
         {
             return false;
         }
-        _bufPointer = reinterpret_cast<char*> (_sizePointer+1);
+        PhaseTimer timer(_settings.getStats(), PHASE_SG_PACK);
+        _sizePointer = _compressor.prepare(_chunk, _sizePointer);
+        _binaryChunkSizeLimit = _compressor.getLimit();
+        _blobTuples = 0;
+        uint32_t* formatPtr = _sizePointer+1;
+        _bufPointer = reinterpret_cast<char*> (formatPtr+1);
         _chunkAddress.coords[0]++;
         _chunk.initialize(this, &super::getArrayDesc(), _chunkAddress, 0);
         size_t dataSize = 0;
-        while(!_reader.end() && (dataSize + _reader.getTuple()->size() + 2*sizeof(uint32_t)) < _binaryChunkSizeLimit &&
-                RedimTuple::getInstanceId(_reader.getTuple()) == _chunkAddress.coords[1])
+        if(_settings.getSgFormat() == SG_FORMAT_DELTA)
         {
-            Value const* tuple = _reader.getTuple();
-            uint32_t const tupleSize = tuple->size();
-            uint32_t* sizePtr = reinterpret_cast<uint32_t*>(_bufPointer);
-            dataSize += (tupleSize + sizeof(uint32_t));
-            *sizePtr = tupleSize;
-            ++sizePtr;
-            _bufPointer = reinterpret_cast<char*>(sizePtr);
-            memcpy(_bufPointer, tuple->data(), tupleSize);
-            _bufPointer += tupleSize;
-            _reader.next();
+            *formatPtr = SG_BLOB_DELTA;
+            dataSize = packDelta();
         }
-        if(dataSize == 0)
+        else if(_settings.isDimensionOnly())
         {
-            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "tuples too large for chunks; raise the memory limit";
+            *formatPtr = SG_BLOB_FIXED;
+            dataSize = packFixed();
+        }
+        else if(_settings.getSgFormat() == SG_FORMAT_COLUMNAR)
+        {
+            *formatPtr = SG_BLOB_COLUMNAR;
+            dataSize = packColumnar();
         }
         else
         {
-            uint32_t* terminatorPtr = reinterpret_cast<uint32_t*>(_bufPointer);
-            *terminatorPtr = 0;
-            dataSize += sizeof(uint32_t);
-            *_sizePointer = static_cast<uint32_t>(dataSize);
+            *formatPtr = SG_BLOB_TUPLES;
+            dataSize = packTuples();
         }
+        if(dataSize == 0)
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "tuples too large for chunks; raise the memory limit";
+        }
+        dataSize = _compressor.compress(_chunk, _sizePointer, dataSize);
+        *_sizePointer = static_cast<uint32_t>(dataSize);
+        _settings.getStats().add(PHASE_SG_PACK, _blobTuples, dataSize, 1);
+        _settings.getStats().addTuplesTo(_chunkAddress.coords[1], _blobTuples);
         ++_rowIndex;
         if(!_reader.end() && RedimTuple::getInstanceId(_reader.getTuple()) != _chunkAddress.coords[1])
         {
@@ -343,23 +841,288 @@ public:
 };
 
 /*
- * Wrap around a single chunk out of the SG and pull tuples out of it.
+ * The SG side of strategy=scatter: wrap around ArrayReader<READ_INPUT> and ship the tuples unsorted, as
+ * SG_BLOB_TUPLES blobs. Every destination instance has a pending blob; each tuple is appended to the blob of its
+ * instance, and a blob that would overflow goes out as the next chunk for that instance. When the input is done the
+ * remaining blobs are flushed. Needs one blob per instance and keeps pace with the scan. The blobs are reserved with
+ * the MemoryGovernor as they grow.
+ */
+class ScatterSgArray : public SinglePassArray
+{
+private:
+    typedef SinglePassArray super;
+    size_t _rowIndex;
+    Address _chunkAddress;
+    MemChunk _chunk;
+    shared_ptr<ArrayReader<READ_INPUT> > _reader;
+    uint32_t* _sizePointer;
+    vector<vector<char> > _blobs;      //per destination instance: [uint32 size][tuple]...
+    vector<Coordinate> _nextChunkNo;   //per destination instance
+    size_t _flushInstance;
+    SgBlobCompressor _compressor;
+    RedimStats& _stats;
+    vector<size_t> _blobTuples;        //per destination instance
+    size_t _blobBytes;                 //capacity of all the blobs
+    MemoryReservation _memory;
+
+    void emit(size_t const instance)
+    {
+        vector<char>& blob = _blobs[instance];
+        _chunkAddress.coords[0] = _nextChunkNo[instance]++;
+        _chunkAddress.coords[1] = instance;
+        _chunk.initialize(this, &super::getArrayDesc(), _chunkAddress, 0);
+        _sizePointer = _compressor.prepare(_chunk, _sizePointer, blob.size() + 3 * sizeof(uint32_t));
+        char* bufPointer = reinterpret_cast<char*> (_sizePointer+1);
+        uint32_t const format = SG_BLOB_TUPLES;
+        uint32_t const terminator = 0;
+        memcpy(bufPointer, &format, sizeof(uint32_t));
+        bufPointer += sizeof(uint32_t);
+        memcpy(bufPointer, &blob[0], blob.size());
+        bufPointer += blob.size();
+        memcpy(bufPointer, &terminator, sizeof(uint32_t));
+        *_sizePointer = static_cast<uint32_t>(_compressor.compress(_chunk, _sizePointer, blob.size() + 2 * sizeof(uint32_t)));
+        _stats.add(PHASE_SG_PACK, _blobTuples[instance], *_sizePointer, 1);
+        _stats.addTuplesTo(instance, _blobTuples[instance]);
+        _blobTuples[instance] = 0;
+        blob.clear();
+        ++_rowIndex;
+    }
+
+public:
+    ScatterSgArray(shared_ptr<ArrayReader<READ_INPUT> > const& reader, Settings const& settings, shared_ptr<Query>& query, MemoryGovernor& governor):
+        super(settings.makeSgSchema(query)),
+        _rowIndex(0),
+        _chunkAddress(0, Coordinates(3,0)),
+        _reader(reader),
+        _blobs(query->getInstancesCount()),
+        _nextChunkNo(query->getInstancesCount(), 0),
+        _flushInstance(0),
+        _compressor(settings, governor, "ScatterSgArray"),
+        _stats(settings.getStats()),
+        _blobTuples(query->getInstancesCount(), 0),
+        _blobBytes(0),
+        _memory(&governor)
+    {
+        super::setEnforceHorizontalIteration(true);
+        _chunkAddress.coords[2] = query->getInstanceID();
+        _sizePointer = _compressor.init(_chunk);
+    }
+
+    size_t getCurrentRowIndex() const
+    {
+        return _rowIndex;
+    }
+
+    bool moveNext(size_t rowIndex)
+    {
+        PhaseTimer timer(_stats, PHASE_SG_PACK);
+        while(!_reader->end())
+        {
+            Value const* tuple = _reader->getTuple();
+            uint32_t const tupleSize = tuple->size();
+            size_t const instance = RedimTuple::getInstanceId(tuple);
+            vector<char>& blob = _blobs[instance];
+            if(blob.size() + tupleSize + 3 * sizeof(uint32_t) >= _compressor.getLimit())
+            {
+                if(blob.empty())
+                {
+                    throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "tuples too large for chunks; raise the memory limit";
+                }
+                emit(instance);
+                return true;
+            }
+            char const* sizePtr = reinterpret_cast<char const*>(&tupleSize);
+            size_t const capacity = blob.capacity();
+            blob.insert(blob.end(), sizePtr, sizePtr + sizeof(uint32_t));
+            blob.insert(blob.end(), reinterpret_cast<char const*>(tuple->data()), reinterpret_cast<char const*>(tuple->data()) + tupleSize);
+            _blobBytes += blob.capacity() - capacity;
+            _memory.update(_blobBytes);
+            ++_blobTuples[instance];
+            _reader->next();
+        }
+        for( ; _flushInstance < _blobs.size(); ++_flushInstance)
+        {
+            if(!_blobs[_flushInstance].empty())
+            {
+                emit(_flushInstance);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    ConstChunk const& getChunk(AttributeID attr, size_t rowIndex)
+    {
+        if(attr==0)
+        {
+            return _chunk;
+        }
+        throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "internal inconsistency";
+    }
+};
+
+/*
+ * Wrap around a single chunk out of the SG and pull tuples out of it. Nothing is copied: getKey points at the tuple
+ * in the pinned chunk (or, for a columnar blob, just its key; for a delta blob, the tuple rebuilt in a buffer) for
+ * the merge, and getAttributes points the views at the values of the current tuple.
  */
 class ChunkTupleUnpacker
 {
 private:
+    struct Column
+    {
+        int8_t const*   missing;
+        char const*     data;
+        uint32_t const* offsets;
+    };
+
     size_t const _overheadSize;
     size_t const _sizeOffset;
+    uint8_t const _nDims;
+    size_t const _nAttrs;
+    vector<bool> const& _attrNullable;
+    vector<size_t> const& _attrSizes;
+    size_t const _keySize;
+    size_t const _fixedTupleSize;
     ConstChunk const* _chunkPtr;
+    uint32_t _format;
     char *_readPtr;
+    char const* _tuplePtr;
+    size_t _tupleSize;
     Value _tupleBuf;
+    vector<char> _deltaTuple;
+    size_t _numRows;
+    size_t _row;
+    char const* _keys;
+    vector<Column> _columns;
+    vector<char> _decompressed;
+    char const* _groupPrefix;
+    uint32_t _groupRemaining;
+    position_t _previousPosition;
+
+    void setColumnarRow()
+    {
+        _tuplePtr = _keys + _row * _keySize;
+        _tupleSize = _keySize;
+    }
+
+    void setUpColumns()
+    {
+        uint32_t const* nPtr = reinterpret_cast<uint32_t const*>(_readPtr);
+        _numRows = *nPtr;
+        if(_numRows == 0)
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "[defensive] encountered a chunk with the first zero tuple.";
+        }
+        char const* ptr = reinterpret_cast<char const*>(nPtr + 1);
+        _keys = ptr;
+        ptr += _numRows * _keySize;
+        for(size_t i=0; i<_nAttrs; ++i)
+        {
+            Column& col = _columns[i];
+            col.missing = NULL;
+            col.offsets = NULL;
+            if(_attrNullable[i])
+            {
+                col.missing = reinterpret_cast<int8_t const*>(ptr);
+                ptr += _numRows;
+            }
+            if(_attrSizes[i] != 0)
+            {
+                col.data = ptr;
+                ptr += _numRows * _attrSizes[i];
+            }
+            else
+            {
+                col.offsets = reinterpret_cast<uint32_t const*>(ptr);
+                col.data = ptr + (_numRows + 1) * sizeof(uint32_t);
+                ptr = col.data + col.offsets[_numRows];
+            }
+        }
+        _row = 0;
+        setColumnarRow();
+    }
+
+    void setUpFixed()
+    {
+        uint32_t const* nPtr = reinterpret_cast<uint32_t const*>(_readPtr);
+        _numRows = *nPtr;
+        if(_numRows == 0)
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "[defensive] encountered a chunk with the first zero tuple.";
+        }
+        _keys = reinterpret_cast<char const*>(nPtr + 1); //whole tuples here, not just keys
+        _row = 0;
+        _tuplePtr = _keys;
+        _tupleSize = _fixedTupleSize;
+    }
+
+    //Rebuild the whole tuple: prefix of the group, position from the delta, then the values
+    void readDeltaTuple()
+    {
+        size_t const prefixSize = _keySize - sizeof(position_t);
+        char const* ptr = _readPtr;
+        if(_groupRemaining == 0)
+        {
+            _groupPrefix = ptr;
+            ptr += prefixSize;
+            memcpy(&_groupRemaining, ptr, sizeof(uint32_t));
+            ptr += sizeof(uint32_t);
+            _previousPosition = 0;
+        }
+        uint64_t delta;
+        uint64_t valuesSize;
+        ptr = readVarint(ptr, delta);
+        ptr = readVarint(ptr, valuesSize);
+        _previousPosition += delta;
+        _deltaTuple.resize(_keySize + valuesSize);
+        char* tuple = &_deltaTuple[0];
+        uint64_t const encodedPosition = RedimTuple::encodeCoordinate(_previousPosition);
+        memcpy(tuple, _groupPrefix, prefixSize);
+        memcpy(tuple + prefixSize, &encodedPosition, sizeof(uint64_t));
+        memcpy(tuple + _keySize, ptr, valuesSize);
+        _readPtr = const_cast<char*>(ptr + valuesSize);
+        --_groupRemaining;
+        _tuplePtr = tuple;
+        _tupleSize = _deltaTuple.size();
+    }
+
+    void setUpDelta()
+    {
+        uint32_t const* nPtr = reinterpret_cast<uint32_t const*>(_readPtr);
+        _numRows = *nPtr;
+        if(_numRows == 0)
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "[defensive] encountered a chunk with the first zero tuple.";
+        }
+        _readPtr = reinterpret_cast<char*>(const_cast<uint32_t*>(nPtr + 1));
+        _row = 0;
+        _groupRemaining = 0;
+        readDeltaTuple();
+    }
 
 public:
-    ChunkTupleUnpacker():
+    ChunkTupleUnpacker(Settings const& settings):
         _overheadSize(getChunkOverheadSize()),
         _sizeOffset(getSizeOffset()),
+        _nDims(settings.getNumOutputDims()),
+        _nAttrs(settings.getNumOutputAttrs()),
+        _attrNullable(settings.outputAttributeNullable()),
+        _attrSizes(settings.getOutputAttributeSizes()),
+        _keySize(RedimTuple::getKeySize(_nDims)),
+        _fixedTupleSize(settings.getFixedTupleSize()),
         _chunkPtr(0),
-        _readPtr(0)
+        _format(0),
+        _readPtr(0),
+        _tuplePtr(0),
+        _tupleSize(0),
+        _numRows(0),
+        _row(0),
+        _keys(0),
+        _columns(_nAttrs),
+        _groupPrefix(0),
+        _groupRemaining(0),
+        _previousPosition(0)
     {}
 
     ~ChunkTupleUnpacker()
@@ -385,6 +1148,40 @@ public:
             throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "[defensive] encountered a chunk with no data.";
         }
         _readPtr = reinterpret_cast<char*>(_chunkPtr->getData()) + _overheadSize;
+        uint32_t* formatPtr = reinterpret_cast<uint32_t*>(_readPtr);
+        _format = *formatPtr;
+        _readPtr = reinterpret_cast<char*>(formatPtr + 1);
+        if(_format & SG_BLOB_COMPRESSED)
+        {
+            _format &= ~SG_BLOB_COMPRESSED;
+            uint32_t const rawSize = *(reinterpret_cast<uint32_t*>(_readPtr));
+            _decompressed.resize(rawSize);
+            long const decompressedSize = LZBlock_decompress(_readPtr + sizeof(uint32_t), &_decompressed[0], chunkSize - 2 * sizeof(uint32_t), rawSize);
+            if(decompressedSize != static_cast<long>(rawSize))
+            {
+                throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "[defensive] encountered a corrupt compressed chunk.";
+            }
+            _readPtr = &_decompressed[0];
+        }
+        if(_format == SG_BLOB_COLUMNAR)
+        {
+            setUpColumns();
+            return;
+        }
+        else if(_format == SG_BLOB_FIXED)
+        {
+            setUpFixed();
+            return;
+        }
+        else if(_format == SG_BLOB_DELTA)
+        {
+            setUpDelta();
+            return;
+        }
+        else if(_format != SG_BLOB_TUPLES)
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "[defensive] encountered a chunk of unknown format.";
+        }
         uint32_t* tupleSizePtr = reinterpret_cast<uint32_t*>(_readPtr);
         uint32_t const tupleSize = *tupleSizePtr;
         if(tupleSize == 0)
@@ -393,21 +1190,82 @@ public:
         }
         ++tupleSizePtr;
         _readPtr = reinterpret_cast<char*> (tupleSizePtr);
-        _tupleBuf.setData(_readPtr, tupleSize);
+        _tuplePtr = _readPtr;
+        _tupleSize = tupleSize;
         _readPtr += tupleSize;
     }
 
+    //The current tuple (or key, for a columnar blob) in place; valid until next()
+    char const* getKey() const
+    {
+        return _tuplePtr;
+    }
+
+    //A copy of the same, for callers that need a Value
     Value const* getTuple()
     {
+        _tupleBuf.setData(_tuplePtr, _tupleSize);
         return &_tupleBuf;
     }
 
+    void getAttributes(vector<AttributeView>& values)
+    {
+        if(_format == SG_BLOB_TUPLES || _format == SG_BLOB_FIXED || _format == SG_BLOB_DELTA)
+        {
+            RedimTuple::viewAttributes(_nDims, _nAttrs, _attrNullable, _attrSizes, _tuplePtr, values);
+            return;
+        }
+        for(size_t i=0; i<_nAttrs; ++i)
+        {
+            Column const& col = _columns[i];
+            AttributeView& v = values[i];
+            v.missingReason = col.missing ? col.missing[_row] : -1;
+            if(col.offsets)
+            {
+                v.data = col.data + col.offsets[_row];
+                v.size = col.offsets[_row+1] - col.offsets[_row];
+            }
+            else
+            {
+                v.data = col.data + _row * _attrSizes[i];
+                v.size = _attrSizes[i];
+            }
+            if(v.missingReason >= 0)
+            {
+                v.size = 0;
+            }
+        }
+    }
+
     void next()
     {
         if(_chunkPtr == NULL)
         {
             throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "internal inconsistency";
         }
+        if(_format == SG_BLOB_COLUMNAR || _format == SG_BLOB_FIXED || _format == SG_BLOB_DELTA)
+        {
+            ++_row;
+            if(_row == _numRows)
+            {
+                _chunkPtr->unPin();
+                _chunkPtr = NULL;
+                return;
+            }
+            if(_format == SG_BLOB_FIXED)
+            {
+                _tuplePtr = _keys + _row * _fixedTupleSize;
+            }
+            else if(_format == SG_BLOB_DELTA)
+            {
+                readDeltaTuple();
+            }
+            else
+            {
+                setColumnarRow();
+            }
+            return;
+        }
         uint32_t* tupleSizePtr = reinterpret_cast<uint32_t*>(_readPtr);
         uint32_t const tupleSize = *tupleSizePtr;
         if(tupleSize == 0)
@@ -418,7 +1276,8 @@ public:
         }
         ++tupleSizePtr;
         _readPtr = reinterpret_cast<char*> (tupleSizePtr);
-        _tupleBuf.setData(_readPtr, tupleSize);
+        _tuplePtr = _readPtr;
+        _tupleSize = tupleSize;
         _readPtr += tupleSize;
     }
 
@@ -437,6 +1296,153 @@ public:
     }
 };
 
+/*
+ * All the tuples one source instance sent to this instance, in order: walks chunk_no through the SG output and
+ * unpacks each chunk in turn. This is one input of the merge tree in globalMerge.
+ * For the parallel merge the stream can start at a later chunk, skip the tuples of the output chunks before a lower
+ * bound and end before an upper bound; both bounds are chunk key prefixes (see RedimTuple::getChunkKeySize).
+ */
+class InstanceTupleStream : public boost::noncopyable
+{
+private:
+    shared_ptr<ConstArrayIterator> _aiter;
+    ChunkTupleUnpacker             _unpacker;
+    Coordinates                    _position;
+    string                         _limit;
+    bool                           _pastLimit;
+
+    void checkLimit()
+    {
+        _pastLimit = _limit.size() && !_unpacker.end() && memcmp(_unpacker.getKey(), _limit.data(), _limit.size()) >= 0;
+    }
+
+    void seek()
+    {
+        if(!_aiter->setPosition(_position))
+        {
+            _aiter.reset();
+            _unpacker.clear();
+        }
+        else
+        {
+            _unpacker.setChunk(&_aiter->getChunk());
+        }
+    }
+
+public:
+    InstanceTupleStream(Settings const& settings):
+        _unpacker(settings),
+        _position(3,0),
+        _pastLimit(false)
+    {}
+
+    void open(shared_ptr<Array>& tupled, InstanceID const dstInstance, size_t const srcInstance, Coordinate const firstChunk = 0)
+    {
+        _position[0] = firstChunk;
+        _position[1] = dstInstance;
+        _position[2] = srcInstance;
+        _aiter = tupled->getConstIterator(0);
+        seek();
+        checkLimit();
+    }
+
+    //Skip the tuples whose chunk key sorts before from
+    void skipTo(string const& from)
+    {
+        while(!end() && memcmp(getKey(), from.data(), from.size()) < 0)
+        {
+            next();
+        }
+    }
+
+    //End at the first tuple whose chunk key is limit or after; call before open
+    void setLimit(string const& limit)
+    {
+        _limit = limit;
+    }
+
+    bool end()
+    {
+        return _unpacker.end() || _pastLimit;
+    }
+
+    char const* getKey() const
+    {
+        return _unpacker.getKey();
+    }
+
+    Value const* getTuple()
+    {
+        return _unpacker.getTuple();
+    }
+
+    void getAttributes(vector<AttributeView>& values)
+    {
+        _unpacker.getAttributes(values);
+    }
+
+    void next()
+    {
+        _unpacker.next();
+        if(_unpacker.end())
+        {
+            _position[0] = _position[0] + 1;
+            seek();
+        }
+        checkLimit();
+    }
+};
+
+/*
+ * The receiving side of strategy=scatter: every tuple this instance got, one source instance after another, in no
+ * particular order. Scatter only sends SG_BLOB_TUPLES, so getTuple always returns the whole tuple.
+ */
+class ReceivedTupleScanner : public boost::noncopyable
+{
+private:
+    shared_ptr<Array>   _tupled;
+    InstanceID const    _dstInstance;
+    size_t const        _numInstances;
+    size_t              _srcInstance;
+    InstanceTupleStream _stream;
+
+    void skipExhausted()
+    {
+        while(_stream.end() && ++_srcInstance < _numInstances)
+        {
+            _stream.open(_tupled, _dstInstance, _srcInstance);
+        }
+    }
+
+public:
+    ReceivedTupleScanner(shared_ptr<Array>& tupled, shared_ptr<Query>& query, Settings const& settings):
+        _tupled(tupled),
+        _dstInstance(query->getInstanceID()),
+        _numInstances(query->getInstancesCount()),
+        _srcInstance(0),
+        _stream(settings)
+    {
+        _stream.open(_tupled, _dstInstance, _srcInstance);
+        skipExhausted();
+    }
+
+    bool end()
+    {
+        return _stream.end();
+    }
+
+    Value const* getTuple()
+    {
+        return _stream.getTuple();
+    }
+
+    void next()
+    {
+        _stream.next();
+        skipExhausted();
+    }
+};
+
 }
 
 using namespace std;
@@ -464,6 +1470,13 @@ public:
         return RedistributeContext(createDistribution(psUndefined), _schema.getResidency() );
     }
 
+    //The SG source over sorted tuples; with aggregate=... equal positions are combined as they are packed
+    template <class TupleSource>
+    shared_ptr<Array> makeTupleSgArray(shared_ptr<TupleSource> const& source, Settings const& settings, shared_ptr<Query>& query, MemoryGovernor& governor)
+    {
+        return shared_ptr<Array>(new TupleSgArray<TupleSource>(source, settings, query, governor));
+    }
+
     shared_ptr<Array> sortArray(shared_ptr<Array> & tupledArray, shared_ptr<Query>& query, Settings const& settings)
     {
         arena::Options options;
@@ -471,87 +1484,294 @@ public:
         options.parent(_arena);
         options.threading(false);
         arena::ArenaPtr sortArena = arena::newArena(options);
+        PhaseTimer timer(settings.getStats(), PHASE_SORT);
         SortingAttributeInfos sortingAttributeInfos(1);
         sortingAttributeInfos[0].columnNo = 0;
         sortingAttributeInfos[0].ascent = true;
+        settings.getStats().noteSortedChunkSize(settings.getSortedArrayChunkSize());
         SortArray sorter(settings.makePreSortSchema(query, true), sortArena, false, settings.getSortedArrayChunkSize());
         shared_ptr<TupleComparator> tcomp(make_shared<TupleComparator>(sortingAttributeInfos, tupledArray->getArrayDesc()));
         return sorter.getSortedArray(tupledArray, query, tcomp);
     }
 
-    shared_ptr<Array> globalMerge(shared_ptr<Array>& tupled, shared_ptr<Query>& query, Settings const& settings)
+    shared_ptr<Array> globalMerge(shared_ptr<Array>& tupled, shared_ptr<Query>& query, Settings const& settings, MemoryGovernor& governor)
+    {
+        PhaseTimer timer(settings.getStats(), PHASE_MERGE);
+        if(settings.getMergeThreads() > 1)
+        {
+            return parallelGlobalMerge(tupled, query, settings, governor);
+        }
+        OutputWriter output(settings, query, governor);
+        mergeRange(tupled, query, settings, output, vector<Coordinate>(query->getInstancesCount(), 0), string(), string());
+        return output.finalize();
+    }
+
+    //Merge the tuples of the output chunks in [from, limit) from every source instance; empty bounds are open
+    void mergeRange(shared_ptr<Array>& tupled, shared_ptr<Query>& query, Settings const& settings, OutputWriter& output,
+                    vector<Coordinate> const& firstChunks, string const& from, string const& limit)
     {
-        OutputWriter output(settings, query);
         size_t const numInstances = query->getInstancesCount();
-        vector<shared_ptr<ConstArrayIterator> > aiters(numInstances);
-        vector<ChunkTupleUnpacker> unpackers(numInstances);
-        vector<Coordinates > positions(numInstances);
-        size_t numClosed = 0;
+        vector<shared_ptr<InstanceTupleStream> > streams(numInstances);
+        vector<InstanceTupleStream*> sources(numInstances);
         for(size_t inst =0; inst<numInstances; ++inst)
         {
-            positions[inst].resize(3);
-            positions[inst][0] = 0;
-            positions[inst][1] = query->getInstanceID();
-            positions[inst][2] = inst;
-            aiters[inst] = tupled->getConstIterator(0);
-            if(!aiters[inst]->setPosition(positions[inst]))
-            {
-                aiters[inst].reset();
-                unpackers[inst].clear();
-                numClosed++;
-            }
-            else
-            {
-                unpackers[inst].setChunk(&aiters[inst]->getChunk());
-            }
+            streams[inst] = make_shared<InstanceTupleStream>(settings);
+            streams[inst]->setLimit(limit);
+            streams[inst]->open(tupled, query->getInstanceID(), inst, firstChunks[inst]);
+            streams[inst]->skipTo(from);
+            sources[inst] = streams[inst].get();
         }
-        while(numClosed < numInstances)
+        TupleLoserTree<InstanceTupleStream> tree(sources);
+        vector<AttributeView> values(settings.getNumOutputAttrs());
+        while(!tree.end())
+        {
+            InstanceTupleStream* winner = tree.getWinner();
+            winner->getAttributes(values);
+            output.writeCell(winner->getKey(), values);
+            tree.next();
+        }
+    }
+
+    //The chunk key of the first tuple in SG chunk chunkNo from srcInstance
+    static string getFirstChunkKey(shared_ptr<ConstArrayIterator>& aiter, ChunkTupleUnpacker& unpacker, Coordinates& position,
+                                   Coordinate const chunkNo, size_t const chunkKeySize)
+    {
+        position[0] = chunkNo;
+        if(!aiter->setPosition(position))
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "[defensive] SG chunk went missing";
+        }
+        unpacker.setChunk(&aiter->getChunk());
+        string result(unpacker.getKey(), chunkKeySize);
+        unpacker.clear();
+        return result;
+    }
+
+    /*
+     * The tuples from each source instance arrive ordered by output chunk, so the merge splits cleanly at output
+     * chunk boundaries. The first tuple of up to MAX_SPLIT_SAMPLES SG chunks per source instance gives the chunk keys
+     * to split at: merge_threads ranges of roughly equal numbers of SG chunks. Each range is merged on its own thread
+     * into the same output array. Ranges never share an output chunk, every range has its own OutputWriter with its
+     * own array iterators, and the writers share one chunk mutex around creating and writing back chunks, so the
+     * MemArray's chunk map and cache only ever see one of them at a time. Within a range every source starts at the
+     * last SG chunk that begins before the range, found by bisection.
+     */
+    shared_ptr<Array> parallelGlobalMerge(shared_ptr<Array>& tupled, shared_ptr<Query>& query, Settings const& settings, MemoryGovernor& governor)
+    {
+        size_t const MAX_SPLIT_SAMPLES = 64;
+        size_t const numInstances = query->getInstancesCount();
+        size_t const chunkKeySize = RedimTuple::getChunkKeySize(settings.getNumOutputDims());
+        InstanceID const dstInstance = query->getInstanceID();
+        vector<Coordinate> numChunks(numInstances, 0);
+        vector<string> samples;
         {
-            Value const* minTuple = NULL;
-            size_t toAdvance;
-            for(size_t inst=0; inst<numInstances; ++inst)
+            shared_ptr<ConstArrayIterator> aiter = tupled->getConstIterator(0);
+            ChunkTupleUnpacker unpacker(settings);
+            Coordinates position(3,0);
+            position[1] = dstInstance;
+            for(size_t inst =0; inst<numInstances; ++inst)
             {
-                if(unpackers[inst].end())
-                {
-                    continue;
-                }
-                Value const* tuple = unpackers[inst].getTuple();
-                if(minTuple == NULL || RedimTuple::redimTupleLess(tuple, minTuple))
+                position[2] = inst;
+                for(position[0] = 0; aiter->setPosition(position); ++position[0])
+                {}
+                numChunks[inst] = position[0];
+                Coordinate const stride = std::max<Coordinate>(1, numChunks[inst] / (Coordinate) MAX_SPLIT_SAMPLES);
+                for(Coordinate chunkNo = stride; chunkNo < numChunks[inst]; chunkNo += stride)
                 {
-                    minTuple = tuple;
-                    toAdvance=inst;
+                    samples.push_back(getFirstChunkKey(aiter, unpacker, position, chunkNo, chunkKeySize));
                 }
             }
-            output.writeTuple(minTuple);
-            unpackers[toAdvance].next();
-            if(unpackers[toAdvance].end())
+        }
+        std::sort(samples.begin(), samples.end());
+        size_t const numThreads = settings.getMergeThreads();
+        vector<string> splits;
+        for(size_t i=1; i<numThreads && samples.size(); ++i)
+        {
+            string const& split = samples[i * samples.size() / numThreads];
+            if(splits.empty() || splits.back() < split)
             {
-                positions[toAdvance][0] = positions[toAdvance][0] + 1;
-                if(!aiters[toAdvance]->setPosition(positions[toAdvance]))
-                {
-                    aiters[toAdvance].reset();
-                    unpackers[toAdvance].clear();
-                    numClosed++;
-                }
-                else
+                splits.push_back(split);
+            }
+        }
+        LOG4CXX_DEBUG(logger, "FR parallel merge over "<<splits.size() + 1<<" ranges from "<<samples.size()<<" samples");
+        shared_ptr<Array> outputArray = std::make_shared<MemArray>(settings.getOutputSchema(), query);
+        shared_ptr<std::mutex> chunkMutex = std::make_shared<std::mutex>();
+        vector<std::future<void> > merges;
+        for(size_t r=0; r<=splits.size(); ++r)
+        {
+            string const from  = r == 0 ? string() : splits[r-1];
+            string const limit = r == splits.size() ? string() : splits[r];
+            merges.push_back(std::async(std::launch::async, [this, &tupled, &query, &settings, &governor, &outputArray, &chunkMutex, &numChunks,
+                                                             from, limit, chunkKeySize, dstInstance, numInstances] ()
+            {
+                PhaseTimer timer(settings.getStats(), PHASE_MERGE, true);
+                vector<Coordinate> firstChunks(numInstances, 0);
+                if(from.size())
                 {
-                    unpackers[toAdvance].setChunk(&aiters[toAdvance]->getChunk());
+                    shared_ptr<ConstArrayIterator> aiter = tupled->getConstIterator(0);
+                    ChunkTupleUnpacker unpacker(settings);
+                    Coordinates position(3,0);
+                    position[1] = dstInstance;
+                    for(size_t inst =0; inst<numInstances; ++inst)
+                    {
+                        position[2] = inst;
+                        Coordinate lo = 0;
+                        Coordinate hi = numChunks[inst];
+                        while(hi - lo > 1)
+                        {
+                            Coordinate const mid = lo + (hi - lo) / 2;
+                            if(getFirstChunkKey(aiter, unpacker, position, mid, chunkKeySize) < from)
+                            {
+                                lo = mid;
+                            }
+                            else
+                            {
+                                hi = mid;
+                            }
+                        }
+                        firstChunks[inst] = lo;
+                    }
                 }
-            }
+                OutputWriter output(settings, query, outputArray, chunkMutex, governor);
+                mergeRange(tupled, query, settings, output, firstChunks, from, limit);
+                output.finalize();
+            }));
+        }
+        for(size_t r=0; r<merges.size(); ++r)
+        {
+            merges[r].get();
+        }
+        return outputArray;
+    }
+
+    shared_ptr<Array> localSortReceived(shared_ptr<Array>& tupled, shared_ptr<Query>& query, Settings const& settings, MemoryGovernor& governor)
+    {
+        ReceivedTupleScanner scanner(tupled, query, settings);
+        ParallelTupleSorter sorter(settings, query, governor);
+        shared_ptr<TupleRunMerger> merger;
+        {
+            PhaseTimer timer(settings.getStats(), PHASE_SORT);
+            merger = sorter.sort(scanner);
+        }
+        PhaseTimer timer(settings.getStats(), PHASE_MERGE);
+        OutputWriter output(settings, query, governor);
+        vector<AttributeView> values(settings.getNumOutputAttrs());
+        while(!merger->end())
+        {
+            Value const* tuple = merger->getTuple();
+            RedimTuple::viewAttributes(settings.getNumOutputDims(),
+                                       settings.getNumOutputAttrs(),
+                                       settings.outputAttributeNullable(),
+                                       settings.getOutputAttributeSizes(),
+                                       reinterpret_cast<char const*>(tuple->data()),
+                                       values);
+            output.writeCell(reinterpret_cast<char const*>(tuple->data()), values);
+            merger->next();
         }
         return output.finalize();
     }
 
+    //The SG: the blobs for instance i go to instance i. Charges the received volume to the redistribute phase
+    shared_ptr<Array> redistribute(shared_ptr<Array>& tupled, shared_ptr<Query>& query, Settings const& settings)
+    {
+        shared_ptr<Array> received;
+        {
+            PhaseTimer timer(settings.getStats(), PHASE_REDISTRIBUTE);
+            received = redistributeToRandomAccess(tupled, createDistribution(psByCol),query->getDefaultArrayResidency(), query, false);
+        }
+        size_t bytes = 0;
+        size_t chunks = 0;
+        for(shared_ptr<ConstArrayIterator> aiter = received->getConstIterator(0); !aiter->end(); ++(*aiter))
+        {
+            bytes += aiter->getChunk().getSize();
+            ++chunks;
+        }
+        settings.getStats().add(PHASE_REDISTRIBUTE, 0, bytes, chunks);
+        return received;
+    }
+
+    shared_ptr<Array> publishStats(shared_ptr<Array> const& output, Settings const& settings, MemoryGovernor const& governor)
+    {
+        RedimStats& stats = settings.getStats();
+        stats.notePeakMemory(governor.getPeakUsed());
+        LOG4CXX_DEBUG(logger, "FR stats "<<stats.toString());
+        RedimStatsRegistry::getInstance().publish(settings.getStatsPtr());
+        return output;
+    }
+
     shared_ptr< Array> execute(vector< shared_ptr< Array> >& inputArrays, shared_ptr<Query> query)
     {
-        ArrayDesc const& inputSchema = inputArrays[0]->getArrayDesc();
-        Settings settings(inputSchema, _schema, _parameters, false, query);
         shared_ptr<Array>& inputArray = inputArrays[0];
-        inputArray = shared_ptr<Array>(new InputScannerArray(inputArray,settings, query));
-        inputArray = sortArray(inputArray, query, settings);
-        inputArray = shared_ptr<Array>(new TupleSgArray(inputArray,settings, query));
-        inputArray = redistributeToRandomAccess(inputArray, createDistribution(psByCol),query->getDefaultArrayResidency(), query, false);
-        return globalMerge(inputArray, query, settings);
+        if(AutoChunker::isAutochunked(_schema))
+        {
+            inputArray = ensureRandomAccess(inputArray, query);
+            Settings probe(inputArray->getArrayDesc(), AutoChunker::withPlaceholderIntervals(_schema), _parameters, false, query);
+            AutoChunker chunker(probe);
+            chunker.scan(inputArray);
+            chunker.exchange(query);
+            chunker.chooseIntervals(_schema);
+        }
+        ArrayDesc const& inputSchema = inputArray->getArrayDesc();
+        Settings settings(inputSchema, _schema, _parameters, false, query);
+        MemoryGovernor governor(settings, _arena, query->getInstancesCount());
+        if(settings.getStrategy() == STRATEGY_SCATTER)
+        {
+            shared_ptr<ArrayReader<READ_INPUT> > reader = make_shared<ArrayReader<READ_INPUT> >(inputArray, settings, &governor);
+            inputArray = shared_ptr<Array>(new ScatterSgArray(reader, settings, query, governor));
+            inputArray = redistribute(inputArray, query, settings);
+            return publishStats(localSortReceived(inputArray, query, settings, governor), settings, governor);
+        }
+        if(settings.getStrategy() == STRATEGY_PIPELINED)
+        {
+            ArrayReader<READ_INPUT> reader(inputArray, settings, &governor);
+            shared_ptr<PipelinedTupleSorter> sorter = make_shared<PipelinedTupleSorter>(settings, query, governor);
+            {
+                PhaseTimer timer(settings.getStats(), PHASE_SORT);
+                sorter->scan(reader);
+            }
+            inputArray = makeTupleSgArray(sorter, settings, query, governor);
+        }
+        else
+        {
+            //the first run tells presorted input apart; the SciDB sort takes the rest unless asked for the run sorter.
+            //Whoever consumes the run owns it from then on, so it is freed once replayed or written out
+            shared_ptr<ArrayReader<READ_INPUT> > reader = make_shared<ArrayReader<READ_INPUT> >(inputArray, settings, &governor);
+            ParallelTupleSorter sorter(settings, query, governor);
+            shared_ptr<TupleRun> firstRun;
+            {
+                PhaseTimer timer(settings.getStats(), PHASE_SORT);
+                firstRun = sorter.fillRun(*reader);
+            }
+            //the first run is the tuple size sample: the SciDB sort lays out its chunks by the estimate
+            if(settings.needTupleSizeSample())
+            {
+                settings.setSampledTupleSize(firstRun->getAverageTupleSize(), firstRun->getNumTuples());
+            }
+            if(firstRun->isOrdered() && reader->end())
+            {
+                //the whole input, in order: it goes to the SG from memory
+                shared_ptr<InputTupleSource> replay = make_shared<InputTupleSource>(std::move(firstRun), *reader);
+                inputArray = makeTupleSgArray(replay, settings, query, governor);
+            }
+            else if(settings.useRunSorter() || firstRun->isOrdered())
+            {
+                shared_ptr<TupleRunMerger> merger;
+                {
+                    PhaseTimer timer(settings.getStats(), PHASE_SORT);
+                    merger = sorter.sort(*reader, std::move(firstRun));
+                }
+                inputArray = makeTupleSgArray(merger, settings, query, governor);
+            }
+            else
+            {
+                inputArray = shared_ptr<Array>(new InputScannerArray(reader, std::move(firstRun), settings, query, governor));
+                inputArray = sortArray(inputArray, query, settings);
+                shared_ptr<ArrayReader<READ_TUPLED> > sorted = make_shared<ArrayReader<READ_TUPLED> >(inputArray, settings);
+                inputArray = makeTupleSgArray(sorted, settings, query, governor);
+            }
+        }
+        inputArray = redistribute(inputArray, query, settings);
+        return publishStats(globalMerge(inputArray, query, settings, governor), settings, governor);
     }
 };
 
@@ -0,0 +1,97 @@
+/*
+**
+* BEGIN_COPYRIGHT
+*
+* Copyright (C) 2008-2016 SciDB, Inc.
+* All Rights Reserved.
+*
+* faster_redimension is a plugin for SciDB, an Open Source Array DBMS maintained
+* by Paradigm4. See http://www.paradigm4.com/
+*
+* faster_redimension is free software: you can redistribute it and/or modify
+* it under the terms of the AFFERO GNU General Public License as published by
+* the Free Software Foundation.
+*
+* faster_redimension is distributed "AS-IS" AND WITHOUT ANY WARRANTY OF ANY KIND,
+* INCLUDING ANY IMPLIED WARRANTY OF MERCHANTABILITY,
+* NON-INFRINGEMENT, OR FITNESS FOR A PARTICULAR PURPOSE. See
+* the AFFERO GNU General Public License for the complete license terms.
+*
+* You should have received a copy of the AFFERO GNU General Public License
+* along with faster_redimension.  If not, see <http://www.gnu.org/licenses/agpl-3.0.html>
+*
+* END_COPYRIGHT
+*/
+
+#include "query/Operator.h"
+#include "array/MemArray.h"
+#include "RedimStats.h"
+
+namespace scidb
+{
+
+using namespace std;
+using faster_redimension::RedimStats;
+using faster_redimension::RedimStatsRegistry;
+
+class PhysicalFasterRedimensionStats : public PhysicalOperator
+{
+public:
+    PhysicalFasterRedimensionStats(string const& logicalName,
+                                   string const& physicalName,
+                                   Parameters const& parameters,
+                                   ArrayDesc const& schema):
+         PhysicalOperator(logicalName, physicalName, parameters, schema)
+    {}
+
+    virtual RedistributeContext getOutputDistribution(
+               std::vector<RedistributeContext> const& inputDistributions,
+               std::vector< ArrayDesc> const& inputSchemas) const
+    {
+        return RedistributeContext(createDistribution(psUndefined), _schema.getResidency() );
+    }
+
+    shared_ptr< Array> execute(vector< shared_ptr< Array> >& inputArrays, shared_ptr<Query> query)
+    {
+        shared_ptr<Array> output = std::make_shared<MemArray>(_schema, query);
+        shared_ptr<RedimStats> stats = RedimStatsRegistry::getInstance().getLast();
+        if(!stats)
+        {
+            return output;
+        }
+        vector<RedimStats::Row> const rows = stats->getRows();
+        size_t const maxRows = RedimStats::getNumRows(query->getInstancesCount());
+        Coordinates position(2, 0);
+        position[0] = query->getInstanceID();
+        Value value;
+        for(AttributeID attr = 0; attr < 6; ++attr) //all but the empty tag
+        {
+            shared_ptr<ArrayIterator> aiter = output->getIterator(attr);
+            int const mode = ChunkIterator::SEQUENTIAL_WRITE | (attr == 0 ? 0 : ChunkIterator::NO_EMPTY_CHECK);
+            position[1] = 0;
+            shared_ptr<ChunkIterator> citer = aiter->newChunk(position).getIterator(query, mode);
+            for(size_t i = 0; i < rows.size() && i < maxRows; ++i)
+            {
+                RedimStats::Row const& row = rows[i];
+                position[1] = i;
+                citer->setPosition(position);
+                switch(attr)
+                {
+                case 0:  value.setString(row.name);   break;
+                case 1:  value.setDouble(row.wallMs); break;
+                case 2:  value.setDouble(row.cpuMs);  break;
+                case 3:  value.setUint64(row.tuples); break;
+                case 4:  value.setUint64(row.bytes);  break;
+                default: value.setUint64(row.chunks); break;
+                }
+                citer->writeItem(value);
+            }
+            citer->flush();
+        }
+        return output;
+    }
+};
+
+REGISTER_PHYSICAL_OPERATOR_FACTORY(PhysicalFasterRedimensionStats, "faster_redimension_stats", "physical_faster_redimension_stats");
+
+} //namespace scidb
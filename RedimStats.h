@@ -0,0 +1,317 @@
+/*
+**
+* BEGIN_COPYRIGHT
+*
+* Copyright (C) 2008-2016 SciDB, Inc.
+* All Rights Reserved.
+*
+* faster_redimension is a plugin for SciDB, an Open Source Array DBMS maintained
+* by Paradigm4. See http://www.paradigm4.com/
+*
+* faster_redimension is free software: you can redistribute it and/or modify
+* it under the terms of the AFFERO GNU General Public License as published by
+* the Free Software Foundation.
+*
+* faster_redimension is distributed "AS-IS" AND WITHOUT ANY WARRANTY OF ANY KIND,
+* INCLUDING ANY IMPLIED WARRANTY OF MERCHANTABILITY,
+* NON-INFRINGEMENT, OR FITNESS FOR A PARTICULAR PURPOSE. See
+* the AFFERO GNU General Public License for the complete license terms.
+*
+* You should have received a copy of the AFFERO GNU General Public License
+* along with faster_redimension.  If not, see <http://www.gnu.org/licenses/agpl-3.0.html>
+*
+* END_COPYRIGHT
+*/
+
+#ifndef REDIMSTATS_H_
+#define REDIMSTATS_H_
+
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+namespace scidb
+{
+namespace faster_redimension
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+ * Where one faster_redimension spent its time, on this instance. Every stage of execute charges a phase:
+ *  - scan: decoding input blocks (ArrayReader<READ_INPUT>)
+ *  - sort: the local sort, whichever engine; tuples and bytes are those sorted, chunks the runs or sort chunks
+ *  - sg_pack: packing tuples into SG blobs; bytes are those sent, after compression
+ *  - redistribute: the SG itself; chunks and bytes are those received
+ *  - merge: the merge (or, with strategy=scatter, the sort) on the receiving side; tuples are the cells produced
+ *  - write: writing the output chunks
+ * Phases nest as the stages pull from one another - the SG pulls blobs, the sort pulls input blocks - so PhaseTimer
+ * keeps a per-thread stack and charges each moment to the innermost phase only. Wall time is that of the thread
+ * running execute; helper threads (sort, output and merge threads) add their CPU time only.
+ */
+enum RedimPhase
+{
+    PHASE_SCAN,
+    PHASE_SORT,
+    PHASE_SG_PACK,
+    PHASE_REDISTRIBUTE,
+    PHASE_MERGE,
+    PHASE_WRITE,
+    NUM_PHASES
+};
+
+inline char const* getPhaseName(size_t const phase)
+{
+    static char const* const names[NUM_PHASES] = { "scan", "sort", "sg_pack", "redistribute", "merge", "write" };
+    return names[phase];
+}
+
+class RedimStats : public boost::noncopyable
+{
+public:
+    //A plain copy of the counters, for reporting
+    struct Row
+    {
+        std::string name;
+        double      wallMs;
+        double      cpuMs;
+        uint64_t    tuples;
+        uint64_t    bytes;
+        uint64_t    chunks;
+    };
+
+private:
+    struct PhaseCounters
+    {
+        std::atomic<uint64_t> wallNanos;
+        std::atomic<uint64_t> cpuNanos;
+        std::atomic<uint64_t> tuples;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> chunks;
+
+        PhaseCounters():
+            wallNanos(0), cpuNanos(0), tuples(0), bytes(0), chunks(0)
+        {}
+    };
+
+    PhaseCounters                             _phases[NUM_PHASES];
+    std::unique_ptr<std::atomic<uint64_t>[]>  _tuplesTo;      //per destination instance
+    size_t const                              _numInstances;
+    std::atomic<uint64_t>                     _peakMemoryBytes;
+    std::atomic<uint64_t>                     _peakStagingBytes;
+    std::atomic<uint64_t>                     _sortedChunkTuples;
+
+    static void raise(std::atomic<uint64_t>& peak, uint64_t const value)
+    {
+        uint64_t current = peak;
+        while(value > current && !peak.compare_exchange_weak(current, value))
+        {}
+    }
+
+public:
+    explicit RedimStats(size_t const numInstances):
+        _tuplesTo(new std::atomic<uint64_t>[numInstances]),
+        _numInstances(numInstances),
+        _peakMemoryBytes(0),
+        _peakStagingBytes(0),
+        _sortedChunkTuples(0)
+    {
+        for(size_t i=0; i<numInstances; ++i)
+        {
+            _tuplesTo[i] = 0;
+        }
+    }
+
+    void charge(RedimPhase const phase, uint64_t const wallNanos, uint64_t const cpuNanos)
+    {
+        _phases[phase].wallNanos += wallNanos;
+        _phases[phase].cpuNanos  += cpuNanos;
+    }
+
+    void add(RedimPhase const phase, uint64_t const tuples, uint64_t const bytes, uint64_t const chunks)
+    {
+        _phases[phase].tuples += tuples;
+        _phases[phase].bytes  += bytes;
+        _phases[phase].chunks += chunks;
+    }
+
+    void addTuplesTo(size_t const instance, uint64_t const tuples)
+    {
+        _tuplesTo[instance] += tuples;
+    }
+
+    //The most memory the operator held: its arena plus the buffers reserved with the MemoryGovernor
+    void notePeakMemory(uint64_t const bytes)
+    {
+        raise(_peakMemoryBytes, bytes);
+    }
+
+    void notePeakStaging(uint64_t const bytes)
+    {
+        raise(_peakStagingBytes, bytes);
+    }
+
+    //The tuples per chunk of a locally sorted array: the SciDB sort's output or a sorted run written out
+    void noteSortedChunkSize(uint64_t const tuples)
+    {
+        raise(_sortedChunkTuples, tuples);
+    }
+
+    static size_t getNumRows(size_t const numInstances)
+    {
+        return NUM_PHASES + 3 + numInstances;
+    }
+
+    /*
+     * One row per phase, then peak_memory_bytes and peak_staging_bytes (in bytes), sorted_chunk_tuples (the largest
+     * chunk of a locally sorted array, in tuples), then a to_instance_N row per destination instance (in tuples)
+     */
+    std::vector<Row> getRows() const
+    {
+        std::vector<Row> result;
+        for(size_t i=0; i<NUM_PHASES; ++i)
+        {
+            PhaseCounters const& p = _phases[i];
+            Row row = { getPhaseName(i), p.wallNanos / 1e6, p.cpuNanos / 1e6, p.tuples, p.bytes, p.chunks };
+            result.push_back(row);
+        }
+        Row memory  = { "peak_memory_bytes",  0, 0, 0, _peakMemoryBytes,  0 };
+        Row staging = { "peak_staging_bytes", 0, 0, 0, _peakStagingBytes, 0 };
+        Row sorted  = { "sorted_chunk_tuples", 0, 0, _sortedChunkTuples, 0, 0 };
+        result.push_back(memory);
+        result.push_back(staging);
+        result.push_back(sorted);
+        for(size_t i=0; i<_numInstances; ++i)
+        {
+            std::ostringstream name;
+            name<<"to_instance_"<<i;
+            Row row = { name.str(), 0, 0, _tuplesTo[i], 0, 0 };
+            result.push_back(row);
+        }
+        return result;
+    }
+
+    std::string toString() const
+    {
+        std::ostringstream output;
+        std::vector<Row> const rows = getRows();
+        for(size_t i=0; i<rows.size(); ++i)
+        {
+            Row const& r = rows[i];
+            output<<" "<<r.name<<" wall_ms="<<r.wallMs<<" cpu_ms="<<r.cpuMs<<" tuples="<<r.tuples<<" bytes="<<r.bytes<<" chunks="<<r.chunks<<";";
+        }
+        return output.str();
+    }
+};
+
+/*
+ * The stats of the last faster_redimension that finished on this instance, for faster_redimension_stats(). There is
+ * one slot for the whole process, not one per query: when several faster_redimension queries run at once, each
+ * overwrites the figures of whichever finished before it.
+ */
+class RedimStatsRegistry
+{
+private:
+    std::mutex                   _mutex;
+    std::shared_ptr<RedimStats>  _last;
+
+public:
+    static RedimStatsRegistry& getInstance()
+    {
+        static RedimStatsRegistry instance;
+        return instance;
+    }
+
+    void publish(std::shared_ptr<RedimStats> const& stats)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _last = stats;
+    }
+
+    std::shared_ptr<RedimStats> getLast()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _last;
+    }
+};
+
+/*
+ * Charges the time from construction to destruction to a phase, minus the time spent in PhaseTimers nested inside
+ * it on the same thread. Construct with helperThread=true on threads other than the one running execute: only CPU
+ * time is charged there.
+ */
+class PhaseTimer : public boost::noncopyable
+{
+private:
+    static PhaseTimer*& current()
+    {
+        static thread_local PhaseTimer* timer = NULL;
+        return timer;
+    }
+
+    RedimStats&       _stats;
+    RedimPhase const  _phase;
+    bool const        _helperThread;
+    PhaseTimer* const _parent;
+    uint64_t          _wallStart;
+    uint64_t          _cpuStart;
+
+    static uint64_t getWallNanos()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static uint64_t getCpuNanos()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    void charge(uint64_t const wallNow, uint64_t const cpuNow)
+    {
+        _stats.charge(_phase, _helperThread ? 0 : wallNow - _wallStart, cpuNow - _cpuStart);
+        _wallStart = wallNow;
+        _cpuStart  = cpuNow;
+    }
+
+public:
+    PhaseTimer(RedimStats& stats, RedimPhase const phase, bool const helperThread = false):
+        _stats(stats),
+        _phase(phase),
+        _helperThread(helperThread),
+        _parent(current()),
+        _wallStart(getWallNanos()),
+        _cpuStart(getCpuNanos())
+    {
+        if(_parent)
+        {
+            _parent->charge(_wallStart, _cpuStart);
+        }
+        current() = this;
+    }
+
+    ~PhaseTimer()
+    {
+        uint64_t const wallNow = getWallNanos();
+        uint64_t const cpuNow  = getCpuNanos();
+        charge(wallNow, cpuNow);
+        current() = _parent;
+        if(_parent)
+        {
+            _parent->_wallStart = wallNow;
+            _parent->_cpuStart  = cpuNow;
+        }
+    }
+};
+
+} } //namespaces
+
+#endif /* REDIMSTATS_H_ */
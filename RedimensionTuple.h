@@ -30,17 +30,64 @@
 #include "query/FunctionLibrary.h"
 #include "query/FunctionDescription.h"
 #include "query/TypeSystem.h"
+#include <endian.h>
 
 using namespace scidb;
 using std::vector;
 
 //Redim tuple:
-//tuple:= [uint8 ndims][uint32 instanceId][Coordinate chunkDim1][Coordinate chunkDim2]..[position_t cellPos][value1][value2][...]
+//tuple:= [uint8 ndims][key uint32 instanceId][key Coordinate chunkDim1][key Coordinate chunkDim2]..[key position_t cellPos][value1][value2][...]
 //value:= ([int8 missing_code])([uint32 size])([data]) //missing_code only present for nullable; size only present for variable-sized types
+//
+//The key fields are normalized: stored big-endian, with the sign bit flipped on the signed ones. That makes the byte
+//order of the prefix the same as the (instanceId, chunk coordinates, position) order, so tuples are compared with
+//a single memcmp over getKeySize(ndims) bytes.
+
+//A value inside a tuple or an SG batch, read in place. missingReason is -1 when the value is present.
+struct AttributeView
+{
+    char const* data;
+    uint32_t    size;
+    int8_t      missingReason;
+};
 
 class RedimTuple
 {
+private:
+    static uint64_t const SIGN_BIT = (1ULL << 63);
+
 public:
+    static size_t getKeySize(uint8_t const nDims)
+    {
+        return sizeof(uint8_t) + sizeof(uint32_t) + sizeof(Coordinate)*nDims + sizeof(position_t);
+    }
+
+    //The key up to the cell position: all tuples of one output chunk share it, and it sorts like the chunks do
+    static size_t getChunkKeySize(uint8_t const nDims)
+    {
+        return getKeySize(nDims) - sizeof(position_t);
+    }
+
+    static uint32_t encodeInstanceId(uint32_t const instanceId)
+    {
+        return htobe32(instanceId);
+    }
+
+    static uint32_t decodeInstanceId(uint32_t const key)
+    {
+        return be32toh(key);
+    }
+
+    static uint64_t encodeCoordinate(int64_t const coord)
+    {
+        return htobe64(static_cast<uint64_t>(coord) ^ SIGN_BIT);
+    }
+
+    static int64_t decodeCoordinate(uint64_t const key)
+    {
+        return static_cast<int64_t>(be64toh(key) ^ SIGN_BIT);
+    }
+
     static void makeRedimTuple(uint8_t const nDims,
                                size_t const nAttrs,
                                vector<bool> const& attrNullable,
@@ -48,16 +95,16 @@ public:
                                uint32_t const dstInstanceId,
                                Coordinates const& chunkCoords,
                                position_t const cellPos,
-                               vector<Value const*> const& values,
+                               vector<AttributeView> const& values,
                                Value* redimTuple)
     {
-        size_t tupleSize = sizeof(uint8_t) + sizeof(uint32_t) + sizeof(Coordinate)*nDims + sizeof(position_t);
+        size_t tupleSize = getKeySize(nDims);
         for(size_t i=0; i<nAttrs; ++i)
         {
             if(attrNullable[i])
             {
                 tupleSize += sizeof(int8_t);
-                if(values[i]->isNull())
+                if(values[i].missingReason >= 0)
                 {
                     continue;
                 }
@@ -69,7 +116,7 @@ public:
             else
             {
                 tupleSize += sizeof(uint32_t);
-                tupleSize += values[i]->size();
+                tupleSize += values[i].size;
             }
         }
         redimTuple->setSize<Value::IGNORE_DATA>(tupleSize);
@@ -77,59 +124,80 @@ public:
         *nDimsPtr = nDims;
         ++nDimsPtr;
         uint32_t* iidPtr = reinterpret_cast<uint32_t*>(nDimsPtr);
-        *iidPtr = dstInstanceId;
+        *iidPtr = encodeInstanceId(dstInstanceId);
         ++iidPtr;
-        Coordinate* coordPtr = reinterpret_cast<Coordinate*>(iidPtr);
+        uint64_t* coordPtr = reinterpret_cast<uint64_t*>(iidPtr);
         for(size_t i=0; i<nDims; ++i)
         {
-            *coordPtr = chunkCoords[i];
+            *coordPtr = encodeCoordinate(chunkCoords[i]);
             ++coordPtr;
         }
-        position_t* posPtr = reinterpret_cast<position_t*>(coordPtr);
-        *posPtr = cellPos;
-        ++posPtr;
-        char* valPtr = reinterpret_cast<char*>(posPtr);
+        *coordPtr = encodeCoordinate(cellPos);
+        ++coordPtr;
+        char* valPtr = reinterpret_cast<char*>(coordPtr);
         for(size_t i=0; i<nAttrs; ++i)
         {
-            Value const* v = values[i];
+            AttributeView const& v = values[i];
             if(attrNullable[i])
             {
                 int8_t* mcPtr = reinterpret_cast<int8_t*>(valPtr);
-                *mcPtr = v->getMissingReason();
+                *mcPtr = v.missingReason;
                 ++mcPtr;
                 valPtr = reinterpret_cast<char*>(mcPtr);
-                if(v->isNull())
+                if(v.missingReason >= 0)
                 {
                     continue;
                 }
             }
             if(attrSizes[i]!=0) //fixed size
             {
-                memcpy(valPtr, v->data(), attrSizes[i]);
+                memcpy(valPtr, v.data, attrSizes[i]);
                 valPtr += attrSizes[i];
             }
             else
             {
                 uint32_t* sizePtr = reinterpret_cast<uint32_t*>(valPtr);
-                *sizePtr = v->size();
+                *sizePtr = v.size;
                 ++sizePtr;
                 valPtr = reinterpret_cast<char*>(sizePtr);
-                memcpy(valPtr, v->data(), v->size());
-                valPtr += v->size();
+                memcpy(valPtr, v.data, v.size);
+                valPtr += v.size;
             }
         }
     }
 
+    static void makeRedimTuple(uint8_t const nDims,
+                               size_t const nAttrs,
+                               vector<bool> const& attrNullable,
+                               vector<size_t> const& attrSizes,
+                               uint32_t const dstInstanceId,
+                               Coordinates const& chunkCoords,
+                               position_t const cellPos,
+                               vector<Value const*> const& values,
+                               vector<AttributeView>& views, //scratch: keep it from call to call and nothing is allocated per tuple
+                               Value* redimTuple)
+    {
+        views.resize(nAttrs);
+        for(size_t i=0; i<nAttrs; ++i)
+        {
+            Value const* v = values[i];
+            views[i].missingReason = v->isNull() ? v->getMissingReason() : -1;
+            views[i].data = reinterpret_cast<char const*>(v->data());
+            views[i].size = v->isNull() ? 0 : v->size();
+        }
+        makeRedimTuple(nDims, nAttrs, attrNullable, attrSizes, dstInstanceId, chunkCoords, cellPos, views, redimTuple);
+    }
+
     static uint32_t getInstanceId(Value const* redimTuple)
     {
         uint32_t* iid = reinterpret_cast<uint32_t*>( reinterpret_cast<char*>(redimTuple->data()) + sizeof(uint8_t) );
-        return *iid;
+        return decodeInstanceId(*iid);
     }
 
     static void setTuplePosition(Value* redimTuple, uint8_t const nDims, position_t const position)
     {
-        position_t* posPtr = reinterpret_cast<position_t*>( reinterpret_cast<char*>(redimTuple->data()) + sizeof(uint8_t) + sizeof(uint32_t) + nDims * sizeof(Coordinate));
-        *posPtr = position;
+        uint64_t* posPtr = reinterpret_cast<uint64_t*>( reinterpret_cast<char*>(redimTuple->data()) + sizeof(uint8_t) + sizeof(uint32_t) + nDims * sizeof(Coordinate));
+        *posPtr = encodeCoordinate(position);
     }
 
     static void decomposeTuple(uint8_t const nDims,
@@ -143,18 +211,17 @@ public:
                                vector<Value>& values)
     {
         uint32_t* iidPtr = reinterpret_cast<uint32_t*>( reinterpret_cast<char*>(redimTuple->data()) + sizeof(uint8_t));
-        dstInstanceId = *iidPtr;
+        dstInstanceId = decodeInstanceId(*iidPtr);
         ++iidPtr;
-        Coordinate* coordPtr = reinterpret_cast<Coordinate*>(iidPtr);
+        uint64_t* coordPtr = reinterpret_cast<uint64_t*>(iidPtr);
         for(size_t i =0; i<nDims; ++i)
         {
-            chunkCoords[i] = *coordPtr;
+            chunkCoords[i] = decodeCoordinate(*coordPtr);
             ++coordPtr;
         }
-        position_t* posPtr = reinterpret_cast<position_t*>(coordPtr);
-        cellPos = *posPtr;
-        ++posPtr;
-        char* valPtr = reinterpret_cast<char*>(posPtr);
+        cellPos = decodeCoordinate(*coordPtr);
+        ++coordPtr;
+        char* valPtr = reinterpret_cast<char*>(coordPtr);
         for(size_t i=0; i<nAttrs; ++i)
         {
             if(attrNullable[i])
@@ -188,59 +255,77 @@ public:
         }
     }
 
-    static bool redimTupleLess(Value const* left, Value const* right)
+    static void decodeKey(uint8_t const nDims,
+                          char const* redimTuple,
+                          Coordinates& chunkCoords,
+                          position_t& cellPos)
     {
-        uint8_t* nDimsL = reinterpret_cast<uint8_t*>(left->data());
-        uint8_t* nDimsR = reinterpret_cast<uint8_t*>(right->data());
-        uint8_t const numCoords = *nDimsL;
-        if(*nDimsR != numCoords)
-        {
-            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "malformed tuple comparison";
-        }
-        nDimsL++;
-        nDimsR++;
-        uint32_t* instanceL = reinterpret_cast<uint32_t*>(nDimsL);
-        uint32_t* instanceR = reinterpret_cast<uint32_t*>(nDimsR);
-        if(*instanceL < *instanceR)
-        {
-            return true;
-        }
-        if(*instanceL > *instanceR)
+        uint64_t const* coordPtr = reinterpret_cast<uint64_t const*>(redimTuple + sizeof(uint8_t) + sizeof(uint32_t));
+        for(size_t i =0; i<nDims; ++i)
         {
-            return false;
+            chunkCoords[i] = decodeCoordinate(*coordPtr);
+            ++coordPtr;
         }
-        ++instanceL;
-        ++instanceR;
-        Coordinate* coordL = reinterpret_cast<Coordinate*>(instanceL);
-        Coordinate* coordR = reinterpret_cast<Coordinate*>(instanceR);
-        for(uint8_t i=0; i<numCoords; ++i)
+        cellPos = decodeCoordinate(*coordPtr);
+    }
+
+    //Like decomposeTuple but without copying: the views point into the tuple
+    static void viewAttributes(uint8_t const nDims,
+                               size_t const nAttrs,
+                               vector<bool> const& attrNullable,
+                               vector<size_t> const& attrSizes,
+                               char const* redimTuple,
+                               vector<AttributeView>& values)
+    {
+        char const* valPtr = redimTuple + getKeySize(nDims);
+        for(size_t i=0; i<nAttrs; ++i)
         {
-            if(*coordL < *coordR)
+            AttributeView& v = values[i];
+            v.missingReason = -1;
+            if(attrNullable[i])
             {
-                return true;
+                int8_t const mc = *reinterpret_cast<int8_t const*>(valPtr);
+                valPtr += sizeof(int8_t);
+                if(mc>=0)
+                {
+                    v.missingReason = mc;
+                    v.data = valPtr;
+                    v.size = 0;
+                    continue;
+                }
             }
-            else if(*coordL > *coordR)
+            if(attrSizes[i]!=0) //fixed size
             {
-                return false;
+                v.size = attrSizes[i];
             }
-            ++coordL;
-            ++coordR;
-        }
-        position_t *posL = reinterpret_cast<position_t*>(coordL);
-        position_t *posR = reinterpret_cast<position_t*>(coordR);
-        if(*posL < *posR)
-        {
-            return true;
+            else
+            {
+                v.size = *reinterpret_cast<uint32_t const*>(valPtr);
+                valPtr += sizeof(uint32_t);
+            }
+            v.data = valPtr;
+            valPtr += v.size;
         }
-        return false;
+    }
+
+    //The leading ndims byte is part of the compared prefix: tuples from the same query always agree on it
+    static bool redimTupleLess(Value const* left, Value const* right)
+    {
+        uint8_t const nDims = *reinterpret_cast<uint8_t*>(left->data());
+        return (memcmp(left->data(), right->data(), getKeySize(nDims)) < 0);
+    }
+
+    //Same order, for tuples read in place
+    static bool redimKeyLess(char const* left, char const* right)
+    {
+        uint8_t const nDims = *reinterpret_cast<uint8_t const*>(left);
+        return (memcmp(left, right, getKeySize(nDims)) < 0);
     }
 
     static bool redimTupleEqual(Value const* left, Value const* right)
     {
-        uint8_t* nDimsL = reinterpret_cast<uint8_t*>(left->data());
-        uint8_t const nDims = *nDimsL;
-        size_t const comparableSize = sizeof(uint8_t) + sizeof(uint32_t) + sizeof(Coordinate) * nDims + sizeof(position_t);
-        return (memcmp(left->data(), right->data(), comparableSize) == 0);
+        uint8_t const nDims = *reinterpret_cast<uint8_t*>(left->data());
+        return (memcmp(left->data(), right->data(), getKeySize(nDims)) == 0);
     }
 };
 
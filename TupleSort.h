@@ -0,0 +1,979 @@
+/*
+**
+* BEGIN_COPYRIGHT
+*
+* Copyright (C) 2008-2016 SciDB, Inc.
+* All Rights Reserved.
+*
+* faster_redimension is a plugin for SciDB, an Open Source Array DBMS maintained
+* by Paradigm4. See http://www.paradigm4.com/
+*
+* faster_redimension is free software: you can redistribute it and/or modify
+* it under the terms of the AFFERO GNU General Public License as published by
+* the Free Software Foundation.
+*
+* faster_redimension is distributed "AS-IS" AND WITHOUT ANY WARRANTY OF ANY KIND,
+* INCLUDING ANY IMPLIED WARRANTY OF MERCHANTABILITY,
+* NON-INFRINGEMENT, OR FITNESS FOR A PARTICULAR PURPOSE. See
+* the AFFERO GNU General Public License for the complete license terms.
+*
+* You should have received a copy of the AFFERO GNU General Public License
+* along with faster_redimension.  If not, see <http://www.gnu.org/licenses/agpl-3.0.html>
+*
+* END_COPYRIGHT
+*/
+
+#ifndef TUPLESORT_H_
+#define TUPLESORT_H_
+
+#include <chrono>
+#include <deque>
+#include <future>
+#include "FasterRedimensionSettings.h"
+#include "MemoryGovernor.h"
+#include "ArrayIO.h"
+#include "RedimensionTuple.h"
+
+namespace scidb
+{
+namespace faster_redimension
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+ * A run of tuples held in one contiguous buffer:
+ * [uint32 size][tuple][uint32 size][tuple]...
+ * sort() only touches memory owned by the run, so separate runs can be sorted on separate threads.
+ *
+ * The radix engine sorts an index of records [varying key bytes][tuple offset] with an LSD pass per key byte.
+ * One histogram pass over the keys finds the bytes that are the same in every tuple - typically ndims, the instance
+ * and the high bytes of coordinates - and those are neither copied into the index nor sorted on. LSD is stable, so
+ * equal tuples keep their input order. The comparison engine breaks ties on the offset, to the same effect.
+ * add() compares each key with the one before it in place, so a run that arrives in order is known to be sorted and
+ * sort() leaves it alone. What the buffers hold, and what the radix sort will add, is reserved with the
+ * MemoryGovernor as the run grows and given back when the run goes.
+ */
+class TupleRun : public boost::noncopyable
+{
+private:
+    static size_t const RADIX_MIN_TUPLES = 256; //below this std::sort is as good
+
+    vector<char>      _data;
+    vector<size_t>    _offsets;
+    size_t const      _keySize;
+    SortEngine const  _engine;
+    bool              _ordered;
+    MemoryReservation _memory;
+
+    struct TupleOffsetLess
+    {
+        char const* _base;
+        size_t      _keySize;
+
+        bool operator() (size_t const i, size_t const j) const
+        {
+            int const c = memcmp(_base + i + sizeof(uint32_t), _base + j + sizeof(uint32_t), _keySize);
+            return c < 0 || (c == 0 && i < j);
+        }
+    };
+
+    char const* getKey(size_t const offset) const
+    {
+        return &_data[offset + sizeof(uint32_t)];
+    }
+
+    void comparisonSort()
+    {
+        TupleOffsetLess comparator;
+        comparator._base = &_data[0];
+        comparator._keySize = _keySize;
+        std::sort(_offsets.begin(), _offsets.end(), comparator);
+    }
+
+    void radixSort()
+    {
+        size_t const nTuples = _offsets.size();
+        vector<size_t> counts(_keySize * 256, 0);
+        for(size_t i =0; i<nTuples; ++i)
+        {
+            uint8_t const* key = reinterpret_cast<uint8_t const*>(getKey(_offsets[i]));
+            for(size_t b =0; b<_keySize; ++b)
+            {
+                ++counts[b * 256 + key[b]];
+            }
+        }
+        vector<size_t> varyingBytes;
+        for(size_t b =0; b<_keySize; ++b)
+        {
+            uint8_t const firstByte = reinterpret_cast<uint8_t const*>(getKey(_offsets[0]))[b];
+            if(counts[b * 256 + firstByte] != nTuples)
+            {
+                varyingBytes.push_back(b);
+            }
+        }
+        size_t const nVarying = varyingBytes.size();
+        if(nVarying == 0)
+        {
+            return;
+        }
+        size_t const recordSize = nVarying + sizeof(size_t);
+        vector<char> records(nTuples * recordSize);
+        vector<char> scratch(nTuples * recordSize);
+        for(size_t i =0; i<nTuples; ++i)
+        {
+            char const* key = getKey(_offsets[i]);
+            char* record = &records[i * recordSize];
+            for(size_t v =0; v<nVarying; ++v)
+            {
+                record[v] = key[varyingBytes[v]];
+            }
+            memcpy(record + nVarying, &_offsets[i], sizeof(size_t));
+        }
+        vector<size_t> bucketStarts(256);
+        for(size_t v = nVarying; v-- > 0; )
+        {
+            size_t const* byteCounts = &counts[varyingBytes[v] * 256];
+            size_t start = 0;
+            for(size_t d =0; d<256; ++d)
+            {
+                bucketStarts[d] = start;
+                start += byteCounts[d];
+            }
+            for(size_t i =0; i<nTuples; ++i)
+            {
+                char const* record = &records[i * recordSize];
+                uint8_t const digit = static_cast<uint8_t>(record[v]);
+                memcpy(&scratch[bucketStarts[digit] * recordSize], record, recordSize);
+                ++bucketStarts[digit];
+            }
+            records.swap(scratch);
+        }
+        for(size_t i =0; i<nTuples; ++i)
+        {
+            memcpy(&_offsets[i], &records[i * recordSize + nVarying], sizeof(size_t));
+        }
+    }
+
+    //Bytes per tuple besides the tuple itself: its offset and, for the radix engine, its record in both index buffers
+    size_t getIndexBytes() const
+    {
+        size_t result = sizeof(size_t);
+        if(_engine == SORT_ENGINE_RADIX)
+        {
+            result += 2 * (_keySize + sizeof(size_t));
+        }
+        return result;
+    }
+
+public:
+    TupleRun(size_t const keySize, size_t const reserveBytes, SortEngine const engine, MemoryGovernor* governor = NULL):
+        _keySize(keySize),
+        _engine(engine),
+        _ordered(true),
+        _memory(governor)
+    {
+        _data.reserve(reserveBytes);
+        _memory.set(_data.capacity());
+    }
+
+    void add(Value const* tuple)
+    {
+        uint32_t const tupleSize = tuple->size();
+        size_t const offset = _data.size();
+        if(_ordered && offset != 0 && memcmp(getKey(_offsets.back()), tuple->data(), _keySize) > 0)
+        {
+            _ordered = false;
+        }
+        _data.resize(offset + sizeof(uint32_t) + tupleSize);
+        memcpy(&_data[offset], &tupleSize, sizeof(uint32_t));
+        memcpy(&_data[offset + sizeof(uint32_t)], tuple->data(), tupleSize);
+        _offsets.push_back(offset);
+        _memory.update(_data.capacity() + _offsets.capacity() * getIndexBytes());
+    }
+
+    size_t getNumTuples() const
+    {
+        return _offsets.size();
+    }
+
+    //The average encoded tuple, without the size prefix; 0 for an empty run
+    size_t getAverageTupleSize() const
+    {
+        size_t const n = _offsets.size();
+        return n ? (_data.size() - n * sizeof(uint32_t)) / n : 0;
+    }
+
+    //Whether the tuples were added in key order; equal keys are in order
+    bool isOrdered() const
+    {
+        return _ordered;
+    }
+
+    //Includes the two index buffers the radix sort will allocate, at their largest
+    size_t getMemoryUsage() const
+    {
+        return _data.size() + _offsets.size() * getIndexBytes();
+    }
+
+    //sort() on a sort thread, charged to the sort phase; a run that arrived in order costs and counts nothing
+    void sortOnHelper(RedimStats& stats)
+    {
+        if(_ordered)
+        {
+            return;
+        }
+        PhaseTimer timer(stats, PHASE_SORT, true);
+        sort();
+        stats.add(PHASE_SORT, getNumTuples(), _data.size(), 1);
+    }
+
+    void sort()
+    {
+        if(_ordered)
+        {
+            return;
+        }
+        if(_engine == SORT_ENGINE_RADIX && _offsets.size() >= RADIX_MIN_TUPLES)
+        {
+            radixSort();
+        }
+        else
+        {
+            comparisonSort();
+        }
+    }
+
+    char const* getTupleData(size_t const i) const
+    {
+        return getKey(_offsets[i]);
+    }
+
+    uint32_t getTupleSize(size_t const i) const
+    {
+        uint32_t result;
+        memcpy(&result, &_data[_offsets[i]], sizeof(uint32_t));
+        return result;
+    }
+};
+
+/*
+ * Tournament (loser) tree over k sorted tuple sources for the k-way merges. Each internal node keeps the loser of the
+ * match played there and the overall winner is kept on the side, so advancing the winner replays one leaf-to-root
+ * path: log(k) comparisons per tuple instead of k. A source is anything with end(), getKey(), getTuple() and next();
+ * matches compare the keys in place and sources that reach their end lose every match. Ties go to the lower source index, which is the order the old linear scan
+ * picked.
+ */
+template <class TupleSource>
+class TupleLoserTree : public boost::noncopyable
+{
+private:
+    vector<TupleSource*> _sources;
+    size_t const         _numSources;
+    vector<size_t>       _losers;   //internal nodes [1, _numSources); leaf i sits at _numSources + i
+    size_t               _winner;
+
+    bool before(size_t const i, size_t const j) const
+    {
+        bool const iEnd = _sources[i]->end();
+        bool const jEnd = _sources[j]->end();
+        if(iEnd || jEnd)
+        {
+            return jEnd && (!iEnd || i < j);
+        }
+        char const* left  = _sources[i]->getKey();
+        char const* right = _sources[j]->getKey();
+        if(RedimTuple::redimKeyLess(left, right))
+        {
+            return true;
+        }
+        if(RedimTuple::redimKeyLess(right, left))
+        {
+            return false;
+        }
+        return i < j;
+    }
+
+    size_t play(size_t const node)
+    {
+        if(node >= _numSources)
+        {
+            return node - _numSources;
+        }
+        size_t const left  = play(2 * node);
+        size_t const right = play(2 * node + 1);
+        if(before(left, right))
+        {
+            _losers[node] = right;
+            return left;
+        }
+        _losers[node] = left;
+        return right;
+    }
+
+public:
+    TupleLoserTree(vector<TupleSource*> const& sources):
+        _sources(sources),
+        _numSources(sources.size()),
+        _losers(sources.size(), 0),
+        _winner(0)
+    {
+        if(_numSources == 0)
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "merge over no sources";
+        }
+        _winner = play(1);
+    }
+
+    bool end() const
+    {
+        return _sources[_winner]->end();
+    }
+
+    Value const* getTuple() const
+    {
+        if(end())
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "Internal inconsistency";
+        }
+        return _sources[_winner]->getTuple();
+    }
+
+    TupleSource* getWinner() const
+    {
+        if(end())
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "Internal inconsistency";
+        }
+        return _sources[_winner];
+    }
+
+    void next()
+    {
+        if(end())
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "Internal inconsistency";
+        }
+        _sources[_winner]->next();
+        size_t winner = _winner;
+        for(size_t node = (_numSources + winner) / 2; node >= 1; node /= 2)
+        {
+            if(before(_losers[node], winner))
+            {
+                std::swap(_losers[node], winner);
+            }
+        }
+        _winner = winner;
+    }
+};
+
+/*
+ * Merge several sorted run arrays into one stream. Presents the same end/getTuple/next interface as ArrayReader
+ * so that it can feed TupleSgArray directly. Equal tuples come out in run order. When the runs are known to follow
+ * one another - each starts at or after the end of the one before, as with presorted input - they are read back
+ * one after the other and no keys are compared.
+ */
+class TupleRunMerger : public boost::noncopyable
+{
+private:
+    vector<shared_ptr<ArrayReader<READ_TUPLED> > > _readers;
+    std::unique_ptr<TupleLoserTree<ArrayReader<READ_TUPLED> > > _tree;
+    bool const _concatenate;
+    size_t     _current;
+
+    void skipExhausted()
+    {
+        while(_current < _readers.size() && _readers[_current]->end())
+        {
+            ++_current;
+        }
+    }
+
+public:
+    TupleRunMerger(vector<shared_ptr<Array> > const& runs, Settings const& settings, bool const concatenate = false):
+        _concatenate(concatenate),
+        _current(0)
+    {
+        vector<ArrayReader<READ_TUPLED>*> sources;
+        for(size_t i =0; i<runs.size(); ++i)
+        {
+            shared_ptr<Array> run = runs[i];
+            _readers.push_back(std::make_shared<ArrayReader<READ_TUPLED> >(run, settings));
+            sources.push_back(_readers[i].get());
+        }
+        if(_concatenate)
+        {
+            skipExhausted();
+        }
+        else if(!sources.empty())
+        {
+            _tree.reset(new TupleLoserTree<ArrayReader<READ_TUPLED> >(sources));
+        }
+    }
+
+    bool end() const
+    {
+        if(_concatenate)
+        {
+            return _current >= _readers.size();
+        }
+        return _tree.get() == NULL || _tree->end();
+    }
+
+    Value const* getTuple() const
+    {
+        if(end())
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "Internal inconsistency";
+        }
+        return _concatenate ? _readers[_current]->getTuple() : _tree->getTuple();
+    }
+
+    void next()
+    {
+        if(end())
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "Internal inconsistency";
+        }
+        if(_concatenate)
+        {
+            _readers[_current]->next();
+            skipExhausted();
+            return;
+        }
+        _tree->next();
+    }
+};
+
+/*
+ * Write a sorted run out to a MemArray of the run schema, which spills to disk like any other MemArray. When the
+ * tuple size is only a guess, the chunks are sized from the tuples of the run itself.
+ */
+inline shared_ptr<Array> writeRunArray(TupleRun const& run, ArrayDesc const& runSchema, Settings const& settings, shared_ptr<Query> const& query)
+{
+    shared_ptr<Array> result = std::make_shared<MemArray>(runSchema, query);
+    shared_ptr<ArrayIterator> tupleArrayIter = result->getIterator(0);
+    shared_ptr<ArrayIterator> tagArrayIter   = result->getIterator(1);
+    shared_ptr<ChunkIterator> tupleChunkIter;
+    shared_ptr<ChunkIterator> tagChunkIter;
+    size_t const chunkSize = settings.getSortedArrayChunkSize(run.getAverageTupleSize());
+    settings.getStats().noteSortedChunkSize(chunkSize);
+    Coordinates pos(1,0);
+    Value tuple;
+    Value boolTrue;
+    boolTrue.setBool(true);
+    for(size_t i =0; i<run.getNumTuples(); ++i)
+    {
+        if(pos[0] % chunkSize == 0)
+        {
+            if(tupleChunkIter.get())
+            {
+                tupleChunkIter->flush();
+                tagChunkIter->flush();
+            }
+            tupleChunkIter = tupleArrayIter->newChunk(pos).getIterator(query, ChunkIterator::SEQUENTIAL_WRITE | ChunkIterator::NO_EMPTY_CHECK);
+            tagChunkIter   = tagArrayIter->newChunk(pos).getIterator(query, ChunkIterator::SEQUENTIAL_WRITE | ChunkIterator::NO_EMPTY_CHECK);
+        }
+        tuple.setData(run.getTupleData(i), run.getTupleSize(i));
+        tupleChunkIter->setPosition(pos);
+        tupleChunkIter->writeItem(tuple);
+        tagChunkIter->setPosition(pos);
+        tagChunkIter->writeItem(boolTrue);
+        ++pos[0];
+    }
+    if(tupleChunkIter.get())
+    {
+        tupleChunkIter->flush();
+        tagChunkIter->flush();
+    }
+    return result;
+}
+
+/*
+ * Local sort that uses several cores. The input is cut into runs that are sorted on worker threads while the main
+ * thread keeps reading. Sorted runs are written out to MemArrays (which spill to disk like any other MemArray) and
+ * merged on the way into the SG. At most sort_threads runs are in flight plus the one being filled, and together
+ * they stay within merge-sort-buffer: with memory_budget_bytes the size of each new run is asked of the
+ * MemoryGovernor, which counts the runs held here among the memory in use. Runs are sorted with the radix engine
+ * unless sort_engine=comparison.
+ * Presorted input costs no sort: a run that arrived in order is not handed to a sort thread, and if every run did
+ * and each one starts where the one before left off, the runs are concatenated instead of merged. Order is checked
+ * as the tuples stream in, so a break anywhere just means that run gets sorted and the runs get merged.
+ */
+class ParallelTupleSorter : public boost::noncopyable
+{
+private:
+    typedef std::pair<shared_ptr<TupleRun>, std::future<void> > PendingRun;
+
+    Settings const&   _settings;
+    shared_ptr<Query> _query;
+    MemoryGovernor&   _governor;
+    size_t const      _numThreads;
+    size_t const      _runSizeLimit;
+    size_t const      _keySize;
+    ArrayDesc const   _runSchema;
+    size_t            _heldBytes;  //by the runs waiting for their sort
+
+    static size_t computeRunSizeLimit(Settings const& settings)
+    {
+        size_t result = settings.getMergeSortBufferSize() / (settings.getSortThreads() + 1);
+        if(result < settings.getSortChunkSizeLimit())
+        {
+            result = settings.getSortChunkSizeLimit();
+        }
+        return result;
+    }
+
+    //Wait for the oldest run to be sorted and write it out; its memory is given back as it goes
+    void retire(std::deque<PendingRun>& pending, vector<shared_ptr<Array> >& runs)
+    {
+        pending.front().second.get();
+        runs.push_back(writeRunArray(*(pending.front().first), _runSchema, _settings, _query));
+        _heldBytes -= pending.front().first->getMemoryUsage();
+        pending.pop_front();
+    }
+
+public:
+    ParallelTupleSorter(Settings const& settings, shared_ptr<Query> const& query, MemoryGovernor& governor):
+        _settings(settings),
+        _query(query),
+        _governor(governor),
+        _numThreads(settings.getSortThreads()),
+        _runSizeLimit(computeRunSizeLimit(settings)),
+        _keySize(RedimTuple::getKeySize(settings.getNumOutputDims())),
+        _runSchema(settings.makeRunSchema(query)),
+        _heldBytes(0)
+    {}
+
+    //Read one run's worth of tuples from the source, noting as it goes whether they arrive in order
+    template <class TupleSource>
+    shared_ptr<TupleRun> fillRun(TupleSource& reader)
+    {
+        size_t const limit = _governor.getRunSizeLimit(_runSizeLimit, _numThreads, _heldBytes);
+        shared_ptr<TupleRun> run = std::make_shared<TupleRun>(_keySize, limit, _settings.getSortEngine(), &_governor);
+        while(!reader.end() && run->getMemoryUsage() < limit)
+        {
+            run->add(reader.getTuple());
+            reader.next();
+        }
+        return run;
+    }
+
+    /*
+     * Drain a tuple source (end, getTuple, next) into sorted runs and return a merger over them. The source is
+     * ArrayReader<READ_INPUT> over the input or, with strategy=scatter, the tuples received in the SG. firstRun, if
+     * given, is a run already taken from the front of the source with fillRun.
+     */
+    template <class TupleSource>
+    shared_ptr<TupleRunMerger> sort(TupleSource& reader, shared_ptr<TupleRun> firstRun = shared_ptr<TupleRun>())
+    {
+        vector<shared_ptr<Array> > runs;
+        std::deque<PendingRun> pending;
+        bool chained = true;
+        string lastKey;
+        while((firstRun.get() && firstRun->getNumTuples()) || !reader.end())
+        {
+            shared_ptr<TupleRun> run = firstRun.get() ? firstRun : fillRun(reader);
+            firstRun.reset();
+            if(!run->isOrdered() || (lastKey.size() && memcmp(lastKey.data(), run->getTupleData(0), _keySize) > 0))
+            {
+                chained = false;
+            }
+            lastKey.assign(run->getTupleData(run->getNumTuples() - 1), _keySize);
+            std::launch const policy = run->isOrdered() ? std::launch::deferred : std::launch::async;
+            pending.push_back(PendingRun(run, std::async(policy, &TupleRun::sortOnHelper, run.get(), std::ref(_settings.getStats()))));
+            _heldBytes += run->getMemoryUsage();
+            if(pending.size() >= _numThreads)
+            {
+                retire(pending, runs);
+            }
+        }
+        while(!pending.empty())
+        {
+            retire(pending, runs);
+        }
+        LOG4CXX_DEBUG(logger, "FR sorted "<<runs.size()<<" runs on "<<_numThreads<<" threads"<<(chained ? "; input was presorted" : ""));
+        return std::make_shared<TupleRunMerger>(runs, _settings, chained);
+    }
+};
+
+/*
+ * Replays a run taken from the front of a tuple source with ParallelTupleSorter::fillRun, then goes on with the rest
+ * of the source: what the run sorter read to check for presorted input is not read again when the SciDB sort is used
+ * after all. The run is owned here and freed as soon as it has been replayed.
+ */
+template <class TupleSource>
+class RunReplaySource : public boost::noncopyable
+{
+private:
+    shared_ptr<TupleRun> _run;
+    TupleSource&         _source;
+    size_t               _index;
+    Value                _tuple;
+
+    void load()
+    {
+        if(_run.get() && _index < _run->getNumTuples())
+        {
+            _tuple.setData(_run->getTupleData(_index), _run->getTupleSize(_index));
+        }
+        else
+        {
+            _run.reset();
+        }
+    }
+
+public:
+    RunReplaySource(shared_ptr<TupleRun> run, TupleSource& source):
+        _run(std::move(run)),
+        _source(source),
+        _index(0)
+    {
+        load();
+    }
+
+    bool end() const
+    {
+        return _run.get() == NULL && _source.end();
+    }
+
+    Value const* getTuple() const
+    {
+        return _run.get() ? &_tuple : _source.getTuple();
+    }
+
+    void next()
+    {
+        if(_run.get() == NULL)
+        {
+            _source.next();
+            return;
+        }
+        ++_index;
+        load();
+    }
+};
+
+/*
+ * The local sort for strategy=pipelined. Tuples are cut by destination instance as they are read, and every
+ * destination's tuples are sorted apart from the others, so TupleSgArray can pack and send the lowest destinations
+ * while the higher ones are still sorting. During the scan each destination fills runs of up to
+ * sort_chunk_size_limit_bytes, and no more than an equal share of merge-sort-buffer (memory_budget_bytes if given)
+ * among the destinations and the sort threads; the limit is asked of the MemoryGovernor again whenever a run is full.
+ * Full runs are sorted on worker threads as in ParallelTupleSorter. Sorted runs wait in memory for their destination
+ * to be sent, but when the runs held exceed the budget the scan stops, lets the sorts in flight finish and writes
+ * every sorted run out to a MemArray (which spills to disk like any other), so memory stays bounded for inputs of any
+ * size. After the scan the partial runs are queued in destination order, with at most sort_threads sorts in flight.
+ * Moving on to a destination waits for its own runs only and merges them, in memory or written out, with a loser
+ * tree; the runs of a destination are freed once it has been sent.
+ */
+class PipelinedTupleSorter : public boost::noncopyable
+{
+private:
+    static size_t const MIN_RUN_SIZE = 64 * 1024;
+
+    struct SortTask
+    {
+        shared_ptr<TupleRun> run;
+        shared_ptr<Array>    spilled;   //the sorted run written out, once run is gone
+        std::future<void>    done;
+        bool                 launched;
+    };
+
+    //Walks one sorted run, in memory or written out; a source for TupleLoserTree. Only the tuple that wins is copied out
+    class RunCursor
+    {
+    private:
+        TupleRun const*                        _run;
+        shared_ptr<ArrayReader<READ_TUPLED> >  _spilled;
+        size_t                                 _index;
+        Value                                  _tuple;
+
+    public:
+        RunCursor(SortTask& task, Settings const& settings):
+            _run(task.run.get()),
+            _index(0)
+        {
+            if(_run == NULL)
+            {
+                _spilled = std::make_shared<ArrayReader<READ_TUPLED> >(task.spilled, settings);
+            }
+        }
+
+        bool end() const
+        {
+            return _spilled.get() ? _spilled->end() : _index >= _run->getNumTuples();
+        }
+
+        char const* getKey() const
+        {
+            return _spilled.get() ? _spilled->getKey() : _run->getTupleData(_index);
+        }
+
+        Value const* getTuple()
+        {
+            if(_spilled.get())
+            {
+                return _spilled->getTuple();
+            }
+            _tuple.setData(_run->getTupleData(_index), _run->getTupleSize(_index));
+            return &_tuple;
+        }
+
+        void next()
+        {
+            if(_spilled.get())
+            {
+                _spilled->next();
+                return;
+            }
+            ++_index;
+        }
+    };
+
+    Settings const&                     _settings;
+    shared_ptr<Query>                   _query;
+    MemoryGovernor&                     _governor;
+    size_t const                        _numInstances;
+    size_t const                        _numThreads;
+    size_t const                        _memoryLimit;
+    size_t                              _runSizeLimit;
+    size_t const                        _keySize;
+    ArrayDesc const                     _runSchema;
+    vector<shared_ptr<SortTask> >       _tasks;
+    vector<vector<size_t> >             _destinationTasks;
+    std::deque<size_t>                  _queued;
+    std::deque<size_t>                  _inFlight;
+    size_t                              _heldBytes;     //by the runs in memory, filling or sorted
+    size_t                              _queuedBytes;   //by the runs in memory that are sorted or queued for it
+    size_t                              _numSpilled;
+    size_t                              _destination;
+    vector<shared_ptr<RunCursor> >      _cursors;
+    std::unique_ptr<TupleLoserTree<RunCursor> > _tree;
+
+    size_t computeRunSizeLimit()
+    {
+        return std::max(std::min(_governor.getSortChunkSizeLimit(), _memoryLimit / (_numInstances + _numThreads)), (size_t) MIN_RUN_SIZE);
+    }
+
+    void launch(size_t const task)
+    {
+        SortTask& t = *_tasks[task];
+        t.done = std::async(std::launch::async, &TupleRun::sortOnHelper, t.run.get(), std::ref(_settings.getStats()));
+        t.launched = true;
+        _inFlight.push_back(task);
+    }
+
+    //Retire finished sorts and start queued ones while fewer than sort_threads are running
+    void pump()
+    {
+        for(size_t i = _inFlight.size(); i-- > 0; )
+        {
+            std::future<void>& done = _tasks[_inFlight[i]]->done;
+            if(!done.valid() || done.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            {
+                _inFlight.erase(_inFlight.begin() + i);
+            }
+        }
+        while(_inFlight.size() < _numThreads && !_queued.empty())
+        {
+            size_t const task = _queued.front();
+            _queued.pop_front();
+            if(!_tasks[task]->launched)
+            {
+                launch(task);
+            }
+        }
+    }
+
+    void enqueue(size_t const destination, shared_ptr<TupleRun> const& run)
+    {
+        shared_ptr<SortTask> task = std::make_shared<SortTask>();
+        task->run = run;
+        task->launched = false;
+        _queuedBytes += run->getMemoryUsage();
+        _destinationTasks[destination].push_back(_tasks.size());
+        _queued.push_back(_tasks.size());
+        _tasks.push_back(task);
+        pump();
+    }
+
+    //Over the budget: finish every queued sort and write all the sorted runs out. Runs still filling stay
+    void spillSorted()
+    {
+        while(!_queued.empty() || !_inFlight.empty())
+        {
+            if(!_inFlight.empty())
+            {
+                _tasks[_inFlight.front()]->done.wait();
+            }
+            pump();
+        }
+        for(size_t i =0; i<_tasks.size(); ++i)
+        {
+            SortTask& t = *_tasks[i];
+            if(t.run.get() == NULL)
+            {
+                continue;
+            }
+            t.done.get();
+            t.spilled = writeRunArray(*t.run, _runSchema, _settings, _query);
+            _heldBytes -= t.run->getMemoryUsage();
+            _queuedBytes -= t.run->getMemoryUsage();
+            t.run.reset();
+            ++_numSpilled;
+        }
+    }
+
+    //Wait for the runs of a destination, starting any that are still queued, and set up their merge
+    void openDestination()
+    {
+        _tree.reset();
+        _cursors.clear();
+        for( ; _destination < _numInstances; ++_destination)
+        {
+            vector<size_t> const& tasks = _destinationTasks[_destination];
+            if(tasks.empty())
+            {
+                continue;
+            }
+            vector<RunCursor*> sources;
+            for(size_t i =0; i<tasks.size(); ++i)
+            {
+                SortTask& t = *_tasks[tasks[i]];
+                if(!t.launched)
+                {
+                    launch(tasks[i]);
+                }
+                if(t.done.valid())
+                {
+                    t.done.get();
+                }
+                _cursors.push_back(std::make_shared<RunCursor>(t, _settings));
+                sources.push_back(_cursors.back().get());
+            }
+            pump();
+            _tree.reset(new TupleLoserTree<RunCursor>(sources));
+            return;
+        }
+    }
+
+    void closeDestination()
+    {
+        _tree.reset();
+        _cursors.clear();
+        vector<size_t> const& tasks = _destinationTasks[_destination];
+        for(size_t i =0; i<tasks.size(); ++i)
+        {
+            _tasks[tasks[i]]->run.reset();
+            _tasks[tasks[i]]->spilled.reset();
+        }
+        ++_destination;
+    }
+
+public:
+    PipelinedTupleSorter(Settings const& settings, shared_ptr<Query> const& query, MemoryGovernor& governor):
+        _settings(settings),
+        _query(query),
+        _governor(governor),
+        _numInstances(query->getInstancesCount()),
+        _numThreads(settings.getSortThreads()),
+        _memoryLimit(settings.getMergeSortBufferSize()),
+        _runSizeLimit(computeRunSizeLimit()),
+        _keySize(RedimTuple::getKeySize(settings.getNumOutputDims())),
+        _runSchema(settings.makeRunSchema(query)),
+        _destinationTasks(_numInstances),
+        _heldBytes(0),
+        _queuedBytes(0),
+        _numSpilled(0),
+        _destination(0)
+    {}
+
+    ~PipelinedTupleSorter()
+    {
+        for(size_t i =0; i<_tasks.size(); ++i)
+        {
+            if(_tasks[i]->launched && _tasks[i]->done.valid())
+            {
+                _tasks[i]->done.wait();
+            }
+        }
+    }
+
+    template <class TupleSource>
+    void scan(TupleSource& reader)
+    {
+        vector<shared_ptr<TupleRun> > filling(_numInstances);
+        while(!reader.end())
+        {
+            Value const* tuple = reader.getTuple();
+            size_t const destination = RedimTuple::getInstanceId(tuple);
+            shared_ptr<TupleRun>& run = filling[destination];
+            if(run.get() == NULL)
+            {
+                run = std::make_shared<TupleRun>(_keySize, 0, _settings.getSortEngine(), &_governor);
+            }
+            size_t const usage = run->getMemoryUsage();
+            run->add(tuple);
+            _heldBytes += run->getMemoryUsage() - usage;
+            if(run->getMemoryUsage() >= _runSizeLimit)
+            {
+                enqueue(destination, run);
+                run.reset();
+                while(!_queued.empty())
+                {
+                    _tasks[_inFlight.front()]->done.wait();
+                    pump();
+                }
+                _runSizeLimit = computeRunSizeLimit();
+            }
+            if(_heldBytes > _memoryLimit && _queuedBytes > 0)
+            {
+                spillSorted();
+            }
+            reader.next();
+        }
+        for(size_t i =0; i<_numInstances; ++i)
+        {
+            if(filling[i].get())
+            {
+                enqueue(i, filling[i]);
+            }
+        }
+        LOG4CXX_DEBUG(logger, "FR pipelined sort cut the input into "<<_tasks.size()<<" runs, "<<_numSpilled<<" written out");
+        openDestination();
+    }
+
+    bool end() const
+    {
+        return _tree.get() == NULL;
+    }
+
+    Value const* getTuple() const
+    {
+        if(end())
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "Internal inconsistency";
+        }
+        return _tree->getTuple();
+    }
+
+    void next()
+    {
+        if(end())
+        {
+            throw SYSTEM_EXCEPTION(SCIDB_SE_INTERNAL, SCIDB_LE_ILLEGAL_OPERATION) << "Internal inconsistency";
+        }
+        _tree->next();
+        if(_tree->end())
+        {
+            closeDestination();
+            openDestination();
+        }
+    }
+};
+
+} } //namespaces
+
+#endif /* TUPLESORT_H_ */
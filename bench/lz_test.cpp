@@ -0,0 +1,177 @@
+/*
+ * Round-trip and malformed-input checks for the LZBlock codec used by sg_compression=lz: make bench
+ *
+ * Every input is compressed, decompressed into a buffer of exactly the original size and compared, for
+ *  - empty input and inputs shorter than the 12 bytes the match finder needs
+ *  - incompressible (random) input, which must not fit below its own size
+ *  - input over 64KB, with repeats inside and beyond the reach of the 16-bit offset
+ *  - highly repetitive input, including runs long enough for length continuation bytes
+ * Then every truncation of a compressed block, and blocks with corrupted bytes, are decompressed: they must be
+ * rejected or come out different, and must never write past the output buffer.
+ * Prints one line per failure and exits with status 1 if there was any.
+ *
+ * usage: lz_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <LZBlock/LZBlock.h>
+
+using std::string;
+using std::vector;
+
+namespace
+{
+
+size_t const GUARD_BYTES = 64;
+char const   GUARD       = (char) 0xA5;
+
+size_t numChecks   = 0;
+size_t numFailures = 0;
+
+void check(bool const ok, string const& name, char const* what)
+{
+    ++numChecks;
+    if(!ok)
+    {
+        ++numFailures;
+        printf("FAIL %s: %s\n", name.c_str(), what);
+    }
+}
+
+uint64_t nextRandom(uint64_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+//Decompress into dstCapacity bytes followed by a guard; false if the guard was touched
+bool decompressGuarded(string const& block, size_t const dstCapacity, long& result, string& output)
+{
+    vector<char> dst(dstCapacity + GUARD_BYTES, GUARD);
+    result = LZBlock_decompress(block.data(), dst.data(), block.size(), dstCapacity);
+    for(size_t i = dstCapacity; i < dst.size(); ++i)
+    {
+        if(dst[i] != GUARD)
+        {
+            return false;
+        }
+    }
+    output.assign(dst.data(), result > 0 ? result : 0);
+    return true;
+}
+
+//Compress with room for the worst case; returns the block
+string compress(string const& input)
+{
+    vector<char> dst(LZBlock_compressBound(input.size()));
+    size_t const size = LZBlock_compress(input.data(), dst.data(), input.size(), dst.size());
+    return string(dst.data(), size);
+}
+
+string roundTrip(string const& name, string const& input)
+{
+    string const block = compress(input);
+    check(block.size() > 0, name, "does not compress within LZBlock_compressBound");
+    check(block.size() <= LZBlock_compressBound(input.size()), name, "compressed size over LZBlock_compressBound");
+    long result;
+    string output;
+    check(decompressGuarded(block, input.size(), result, output), name, "decompress wrote past the output buffer");
+    check(result == (long) input.size(), name, "decompressed size differs");
+    check(output == input, name, "decompressed bytes differ");
+    if(input.size())
+    {
+        check(decompressGuarded(block, input.size() - 1, result, output) && result == -1, name,
+              "decompress into a buffer one byte short is not rejected");
+    }
+    return block;
+}
+
+//Every prefix of the block, and every byte of it flipped in turn: rejected or different, never out of bounds
+void malformed(string const& name, string const& input, string const& block)
+{
+    long result;
+    string output;
+    for(size_t len = 0; len < block.size(); ++len)
+    {
+        bool const guarded = decompressGuarded(block.substr(0, len), input.size(), result, output);
+        check(guarded, name + " truncated", "decompress wrote past the output buffer");
+        check(result != (long) input.size() || output != input, name + " truncated", "truncated block decodes to the input");
+    }
+    uint64_t state = 0x2545F4914F6CDD1DULL;
+    for(size_t i = 0; i < block.size(); ++i)
+    {
+        string corrupt = block;
+        corrupt[i] = (char) (corrupt[i] ^ (char) (1 + nextRandom(state) % 255));
+        check(decompressGuarded(corrupt, input.size(), result, output), name + " corrupt", "decompress wrote past the output buffer");
+    }
+    //a first sequence with no literals whose match points before the start of the output
+    char const bogus[] = { 0x00, 0x01, 0x00 };
+    check(decompressGuarded(string(bogus, sizeof(bogus)) + block, input.size() + 64, result, output) && result == -1,
+          name + " bad offset", "match before the start of the output is not rejected");
+}
+
+string randomBytes(size_t const size, uint64_t seed)
+{
+    string result(size, 0);
+    for(size_t i = 0; i < size; ++i)
+    {
+        result[i] = (char) nextRandom(seed);
+    }
+    return result;
+}
+
+} //namespace
+
+int main()
+{
+    roundTrip("empty", string());
+    for(size_t size = 1; size <= 13; ++size)
+    {
+        string const input = randomBytes(size, 7 + size);
+        roundTrip("short " + std::to_string(size), input);
+        roundTrip("short repeated " + std::to_string(size), string(size, 'x'));
+    }
+
+    string const random = randomBytes(100000, 11);
+    roundTrip("incompressible", random);
+    vector<char> tight(random.size());
+    check(LZBlock_compress(random.data(), tight.data(), random.size(), tight.size()) == 0, "incompressible",
+          "fits below its own size");
+
+    //a 3000 byte stretch repeated to 90KB: every repeat is within the 64KB window and the 4096-entry hash table
+    //still holds most of the previous one. A 70KB stretch repeated is out of reach
+    string const near = randomBytes(3000, 13);
+    string nearRepeats;
+    while(nearRepeats.size() < 90000)
+    {
+        nearRepeats += near;
+    }
+    string const nearBlock = roundTrip("over 64KB, repeats in the window", nearRepeats);
+    check(nearBlock.size() < nearRepeats.size() / 3, "over 64KB, repeats in the window", "compresses poorly");
+    string const far = randomBytes(70000, 17);
+    roundTrip("over 64KB, repeats past the window", far + far);
+
+    string const zeros(1 << 20, '\0');
+    string const zerosBlock = roundTrip("repetitive", zeros);
+    check(zerosBlock.size() < zeros.size() / 100, "repetitive", "compresses poorly");
+    string doubles;
+    for(int i = 0; i < 20000; ++i)
+    {
+        double const v = (double) (i % 10) * 0.5;
+        doubles.append(reinterpret_cast<char const*>(&v), sizeof(v));
+    }
+    roundTrip("repeated doubles", doubles);
+
+    malformed("short", string("0123456789abcdef"), compress(string("0123456789abcdef")));
+    malformed("repetitive", doubles.substr(0, 4096), compress(doubles.substr(0, 4096)));
+    malformed("incompressible", random.substr(0, 2048), compress(random.substr(0, 2048)));
+
+    printf("lz_test: %zu checks, %zu failed\n", numChecks, numFailures);
+    return numFailures ? 1 : 0;
+}
@@ -0,0 +1 @@
+#include "../scidb_shim.h"
@@ -0,0 +1,124 @@
+/*
+ * Just enough of SciDB for RedimensionTuple.h to build outside the server: Value, Coordinates and position_t, with
+ * the same layout rules that the codec relies on. Used by the bench target only.
+ */
+
+#ifndef SCIDB_SHIM_H_
+#define SCIDB_SHIM_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+
+namespace scidb
+{
+
+typedef int64_t Coordinate;
+typedef std::vector<Coordinate> Coordinates;
+typedef int64_t position_t;
+
+/*
+ * Like scidb::Value, the data lives in place when it fits in 8 bytes and on the heap otherwise, so encode and decode
+ * pay the same allocations they do in the server.
+ */
+class Value
+{
+private:
+    static size_t const INLINE_SIZE = 8;
+    size_t  _size;
+    int8_t  _missingReason;
+    void*   _data;
+    char    _inline[INLINE_SIZE];
+
+    void* buffer()
+    {
+        return _size <= INLINE_SIZE ? _inline : _data;
+    }
+
+public:
+    enum SetSizeMode { IGNORE_DATA };
+
+    Value():
+        _size(0),
+        _missingReason(-1),
+        _data(NULL)
+    {}
+
+    Value(Value const& other):
+        _size(0),
+        _missingReason(-1),
+        _data(NULL)
+    {
+        *this = other;
+    }
+
+    Value& operator=(Value const& other)
+    {
+        if(this != &other)
+        {
+            setSize<IGNORE_DATA>(other._size);
+            memcpy(data(), other.data(), other._size);
+            _missingReason = other._missingReason;
+        }
+        return *this;
+    }
+
+    ~Value()
+    {
+        if(_size > INLINE_SIZE)
+        {
+            free(_data);
+        }
+    }
+
+    template <SetSizeMode MODE>
+    void setSize(size_t const size)
+    {
+        if(size > INLINE_SIZE && (_size <= INLINE_SIZE || size > _size))
+        {
+            if(_size > INLINE_SIZE)
+            {
+                free(_data);
+            }
+            _data = malloc(size);
+        }
+        else if(size <= INLINE_SIZE && _size > INLINE_SIZE)
+        {
+            free(_data);
+            _data = NULL;
+        }
+        _size = size;
+        _missingReason = -1;
+    }
+
+    void* data() const
+    {
+        return const_cast<Value*>(this)->buffer();
+    }
+
+    size_t size() const
+    {
+        return _size;
+    }
+
+    bool isNull() const
+    {
+        return _missingReason >= 0;
+    }
+
+    int8_t getMissingReason() const
+    {
+        return _missingReason;
+    }
+
+    void setNull(int8_t const reason = 0)
+    {
+        setSize<IGNORE_DATA>(0);
+        _missingReason = reason;
+    }
+};
+
+} //namespace scidb
+
+#endif /* SCIDB_SHIM_H_ */
@@ -0,0 +1,185 @@
+/*
+ * Microbenchmark for the RedimTuple codec and comparator, built against shim/ instead of SciDB: make bench
+ *
+ * For every combination of dimension count, attribute count, nullability and string size it times
+ *  - encode:  makeRedimTuple from attribute views
+ *  - decode:  decomposeTuple into Values
+ *  - view:    viewAttributes, the in-place decode the merge uses
+ *  - compare: redimTupleLess and redimTupleEqual on neighbouring tuples (the keys are random)
+ * and prints ns per tuple (per comparison for compare) and MB/s of tuple bytes, one line each.
+ *
+ * usage: tuple_bench [num_tuples]   (default 200000)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "RedimensionTuple.h"
+
+using std::string;
+
+namespace
+{
+
+struct Config
+{
+    uint8_t nDims;
+    size_t  nAttrs;
+    bool    nullable;
+    size_t  stringSize; //0: every attribute is a double; otherwise the last attribute is a string this long
+};
+
+struct Input
+{
+    vector<bool>                   nullable;
+    vector<size_t>                 sizes;
+    vector<Coordinates>            chunkCoords;
+    vector<position_t>             positions;
+    vector<uint32_t>               instances;
+    vector<vector<AttributeView> > values;
+    vector<double>                 doubles;
+    string                         text;
+};
+
+uint64_t nextRandom(uint64_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+void makeInput(Config const& c, size_t const numTuples, Input& in)
+{
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    in.nullable.assign(c.nAttrs, c.nullable);
+    in.sizes.assign(c.nAttrs, sizeof(double));
+    if(c.stringSize)
+    {
+        in.sizes[c.nAttrs-1] = 0;
+    }
+    in.text.assign(c.stringSize + 1, 'x'); //with the terminator, as SciDB stores strings
+    in.doubles.resize(numTuples * c.nAttrs);
+    in.chunkCoords.assign(numTuples, Coordinates(c.nDims));
+    in.positions.resize(numTuples);
+    in.instances.resize(numTuples);
+    in.values.assign(numTuples, vector<AttributeView>(c.nAttrs));
+    for(size_t t=0; t<numTuples; ++t)
+    {
+        in.instances[t] = nextRandom(state) % 8;
+        for(size_t d=0; d<c.nDims; ++d)
+        {
+            in.chunkCoords[t][d] = (nextRandom(state) % 64) * 1000;
+        }
+        in.positions[t] = nextRandom(state) % 1000000;
+        for(size_t a=0; a<c.nAttrs; ++a)
+        {
+            AttributeView& v = in.values[t][a];
+            double& d = in.doubles[t * c.nAttrs + a];
+            d = (double) nextRandom(state);
+            v.missingReason = (c.nullable && nextRandom(state) % 10 == 0) ? 0 : -1;
+            v.data = in.sizes[a] ? reinterpret_cast<char const*>(&d) : in.text.data();
+            v.size = in.sizes[a] ? in.sizes[a] : c.stringSize + 1;
+        }
+    }
+}
+
+double elapsedNs(std::chrono::steady_clock::time_point const& start)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+void report(char const* op, Config const& c, double const ns, size_t const count, size_t const bytes)
+{
+    printf("%-8s dims=%u attrs=%-3zu nullable=%d string=%-4zu %9.1f ns/op %9.1f MB/s\n",
+           op, (unsigned) c.nDims, c.nAttrs, (int) c.nullable, c.stringSize, ns / count, bytes / ns * 1e3);
+}
+
+size_t volatile sink;
+
+void run(Config const& c, size_t const numTuples)
+{
+    Input in;
+    makeInput(c, numTuples, in);
+    vector<Value> tuples(numTuples);
+    size_t bytes = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(size_t t=0; t<numTuples; ++t)
+    {
+        RedimTuple::makeRedimTuple(c.nDims, c.nAttrs, in.nullable, in.sizes, in.instances[t], in.chunkCoords[t],
+                                   in.positions[t], in.values[t], &tuples[t]);
+    }
+    double ns = elapsedNs(start);
+    for(size_t t=0; t<numTuples; ++t)
+    {
+        bytes += tuples[t].size();
+    }
+    report("encode", c, ns, numTuples, bytes);
+
+    uint32_t instance;
+    Coordinates coords(c.nDims);
+    position_t pos;
+    vector<Value> values(c.nAttrs);
+    size_t check = 0;
+    start = std::chrono::steady_clock::now();
+    for(size_t t=0; t<numTuples; ++t)
+    {
+        RedimTuple::decomposeTuple(c.nDims, c.nAttrs, in.nullable, in.sizes, &tuples[t], instance, coords, pos, values);
+        check += values[c.nAttrs-1].size();
+    }
+    ns = elapsedNs(start);
+    report("decode", c, ns, numTuples, bytes);
+
+    vector<AttributeView> views(c.nAttrs);
+    start = std::chrono::steady_clock::now();
+    for(size_t t=0; t<numTuples; ++t)
+    {
+        RedimTuple::viewAttributes(c.nDims, c.nAttrs, in.nullable, in.sizes, reinterpret_cast<char const*>(tuples[t].data()), views);
+        check += views[c.nAttrs-1].size;
+    }
+    ns = elapsedNs(start);
+    report("view", c, ns, numTuples, bytes);
+
+    start = std::chrono::steady_clock::now();
+    for(size_t t=1; t<numTuples; ++t)
+    {
+        check += RedimTuple::redimTupleLess(&tuples[t-1], &tuples[t]);
+        check += RedimTuple::redimTupleEqual(&tuples[t-1], &tuples[t]);
+    }
+    ns = elapsedNs(start);
+    report("compare", c, ns, 2 * (numTuples - 1), 2 * (numTuples - 1) * RedimTuple::getKeySize(c.nDims));
+    sink = check;
+}
+
+} //namespace
+
+int main(int argc, char** argv)
+{
+    size_t const numTuples = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+    if(numTuples < 2)
+    {
+        fprintf(stderr, "usage: %s [num_tuples >= 2]\n", argv[0]);
+        return 1;
+    }
+    uint8_t const dimCounts[]    = { 2, 4 };
+    size_t  const attrCounts[]   = { 1, 5, 20 };
+    size_t  const stringSizes[]  = { 0, 16, 256 };
+    for(size_t d=0; d<sizeof(dimCounts)/sizeof(dimCounts[0]); ++d)
+    {
+        for(size_t a=0; a<sizeof(attrCounts)/sizeof(attrCounts[0]); ++a)
+        {
+            for(int n=0; n<2; ++n)
+            {
+                for(size_t s=0; s<sizeof(stringSizes)/sizeof(stringSizes[0]); ++s)
+                {
+                    Config const c = { dimCounts[d], attrCounts[a], n != 0, stringSizes[s] };
+                    run(c, numTuples);
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,183 @@
+//-----------------------------------------------------------------------------
+// LZBlock: a small byte-oriented LZ77 block codec. The compressed layout is the
+// LZ4 block format (token, literal run, 16-bit little-endian offset, match
+// length; at least 4-byte matches, last 5 bytes always literal), so blocks can
+// be checked against any LZ4 block decoder. Single-pass greedy matching over a
+// 4096-entry hash table: much faster than it is thorough.
+// This file is placed in the public domain.
+//-----------------------------------------------------------------------------
+
+#ifndef _LZBLOCK_H_
+#define _LZBLOCK_H_
+
+#include <stdint.h>
+#include <string.h>
+
+//-----------------------------------------------------------------------------
+
+namespace lzblock
+{
+
+static const int MIN_MATCH     = 4;
+static const int LAST_LITERALS = 5;
+static const int MF_LIMIT      = 12;
+static const int HASH_LOG      = 12;
+static const int MAX_DISTANCE  = 65535;
+
+inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t result;
+    memcpy(&result, p, sizeof(result));
+    return result;
+}
+
+inline uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+// Length continuation bytes: 255 255 ... remainder
+inline bool writeLength(uint8_t*& op, const uint8_t* oend, size_t len)
+{
+    for( ; len >= 255; len -= 255)
+    {
+        if(op >= oend) return false;
+        *op++ = 255;
+    }
+    if(op >= oend) return false;
+    *op++ = (uint8_t) len;
+    return true;
+}
+
+inline bool readLength(const uint8_t*& ip, const uint8_t* iend, size_t& len)
+{
+    uint8_t b;
+    do
+    {
+        if(ip >= iend) return false;
+        b = *ip++;
+        len += b;
+    } while(b == 255);
+    return true;
+}
+
+// One sequence: literals, then (unless last) a match
+inline bool writeSequence(uint8_t*& op, const uint8_t* oend, const uint8_t* literals, size_t litLen,
+                          size_t offset, size_t matchLen, bool last)
+{
+    if(op >= oend) return false;
+    uint8_t* token = op++;
+    *token = (uint8_t) ((litLen >= 15 ? 15 : litLen) << 4);
+    if(litLen >= 15 && !writeLength(op, oend, litLen - 15)) return false;
+    if((size_t)(oend - op) < litLen) return false;
+    memcpy(op, literals, litLen);
+    op += litLen;
+    if(last) return true;
+    if(oend - op < 2) return false;
+    *op++ = (uint8_t) (offset & 0xFF);
+    *op++ = (uint8_t) (offset >> 8);
+    size_t const code = matchLen - MIN_MATCH;
+    *token |= (uint8_t) (code >= 15 ? 15 : code);
+    if(code >= 15 && !writeLength(op, oend, code - 15)) return false;
+    return true;
+}
+
+} // namespace lzblock
+
+//-----------------------------------------------------------------------------
+// Worst case size of the compressed form of srcSize bytes
+
+inline size_t LZBlock_compressBound(size_t srcSize)
+{
+    return srcSize + srcSize / 255 + 16;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the compressed size, or 0 if it does not fit in dstCapacity
+
+inline size_t LZBlock_compress(const char* src, char* dst, size_t srcSize, size_t dstCapacity)
+{
+    using namespace lzblock;
+    const uint8_t* const base   = (const uint8_t*) src;
+    const uint8_t* const iend   = base + srcSize;
+    const uint8_t* ip           = base;
+    const uint8_t* anchor       = base;
+    uint8_t*             op     = (uint8_t*) dst;
+    const uint8_t* const oend   = op + dstCapacity;
+    if(srcSize > (size_t) MF_LIMIT)
+    {
+        const uint8_t* const mflimit    = iend - MF_LIMIT;
+        const uint8_t* const matchlimit = iend - LAST_LITERALS;
+        uint32_t table[1 << HASH_LOG];
+        memset(table, 0, sizeof(table));
+        while(ip < mflimit)
+        {
+            uint32_t const sequence = read32(ip);
+            uint32_t const h = hash32(sequence);
+            const uint8_t* ref = base + table[h];
+            table[h] = (uint32_t) (ip - base);
+            if(ref >= ip || ip - ref > MAX_DISTANCE || read32(ref) != sequence)
+            {
+                ++ip;
+                continue;
+            }
+            const uint8_t* mp = ip + MIN_MATCH;
+            const uint8_t* rp = ref + MIN_MATCH;
+            while(mp < matchlimit && *mp == *rp)
+            {
+                ++mp;
+                ++rp;
+            }
+            if(!writeSequence(op, oend, anchor, ip - anchor, ip - ref, mp - ip, false)) return 0;
+            ip = mp;
+            anchor = ip;
+        }
+    }
+    if(!writeSequence(op, oend, anchor, iend - anchor, 0, 0, true)) return 0;
+    return op - (uint8_t*) dst;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the decompressed size, or -1 if the block is malformed or does not fit in dstCapacity
+
+inline long LZBlock_decompress(const char* src, char* dst, size_t compressedSize, size_t dstCapacity)
+{
+    using namespace lzblock;
+    const uint8_t*       ip   = (const uint8_t*) src;
+    const uint8_t* const iend = ip + compressedSize;
+    uint8_t*             op   = (uint8_t*) dst;
+    uint8_t* const       oend = op + dstCapacity;
+    while(ip < iend)
+    {
+        uint8_t const token = *ip++;
+        size_t litLen = token >> 4;
+        if(litLen == 15 && !readLength(ip, iend, litLen)) return -1;
+        if((size_t)(iend - ip) < litLen || (size_t)(oend - op) < litLen) return -1;
+        memcpy(op, ip, litLen);
+        ip += litLen;
+        op += litLen;
+        if(ip == iend)
+        {
+            break;
+        }
+        if(iend - ip < 2) return -1;
+        size_t const offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if(offset == 0 || offset > (size_t)(op - (uint8_t*) dst)) return -1;
+        size_t matchLen = token & 15;
+        if(matchLen == 15 && !readLength(ip, iend, matchLen)) return -1;
+        matchLen += MIN_MATCH;
+        if((size_t)(oend - op) < matchLen) return -1;
+        const uint8_t* ref = op - offset;
+        for(size_t i = 0; i < matchLen; ++i)
+        {
+            op[i] = ref[i];
+        }
+        op += matchLen;
+    }
+    return op - (uint8_t*) dst;
+}
+
+//-----------------------------------------------------------------------------
+
+#endif // _LZBLOCK_H_
@@ -0,0 +1,259 @@
+#!/bin/bash
+#Performance suite: redimension vs. faster_redimension over generated inputs.
+#
+#Generates an input array of NUM_CELLS cells in random order ("random") and, for each target grid a sorted case uses,
+#a copy of it in that target's chunk order - by x chunk, y chunk, x, y ("sorted") - then times
+#consume(redimension(...)) and consume(faster_redimension(...)) on a matrix of cases along these axes:
+#
+# attrs       1, 5 or 20 double attributes
+# order       sorted or random input
+# synthetic   none, first or last: a synthetic dimension over 4-way cell collisions
+# string      0 (none), 16 or 256: add a string attribute of that many characters
+# chunk       100 or 1000: the chunk interval of both output dimensions
+# skew        uniform, or skewed: 90% of the cells land in a handful of output chunks
+#
+#By default each axis is varied alone around the base case (attrs=5 order=random synthetic=none string=0 chunk=1000
+#skew=uniform); -x runs the full cross product instead. Each query runs REPEATS times and the fastest run counts.
+#
+#Results go to a CSV file (and, with -j, a JSON file). Give -b a saved results CSV to compare against: any case more
+#than TOLERANCE percent slower than the baseline is reported as a regression and the script exits with status 1.
+#Every run also lists the cases where faster_redimension is slower than redimension.
+
+NUM_CELLS=2000000
+REPEATS=1
+OUTFILE=perfsuite.csv
+JSONFILE=
+BASELINE=
+TOLERANCE=10
+FULL=0
+REGENERATE=0
+FILTER=.
+
+usage()
+{
+    echo "usage: $0 [-n num_cells] [-r repeats] [-o results.csv] [-j results.json] [-b baseline.csv] [-t tolerance_pct]"
+    echo "          [-f case_regex] [-x (full cross product)] [-g (regenerate the inputs)]"
+    exit 2
+}
+
+while getopts "n:r:o:j:b:t:f:xgh" opt; do
+    case $opt in
+        n) NUM_CELLS=$OPTARG ;;
+        r) REPEATS=$OPTARG ;;
+        o) OUTFILE=$OPTARG ;;
+        j) JSONFILE=$OPTARG ;;
+        b) BASELINE=$OPTARG ;;
+        t) TOLERANCE=$OPTARG ;;
+        f) FILTER=$OPTARG ;;
+        x) FULL=1 ;;
+        g) REGENERATE=1 ;;
+        *) usage ;;
+    esac
+done
+
+if [ -n "$BASELINE" ] && [ ! -f "$BASELINE" ] ; then
+    echo "baseline $BASELINE not found"
+    exit 2
+fi
+
+#x, y:   uniform - a 10000-wide grid
+#xk, yk: skewed  - the first 90% of the cells fill a 1000-wide band (a few chunks), the rest are scattered wide
+#yq, ykq: y / 4 and yk / 4, for the synthetic cases
+DENSE=$((NUM_CELLS * 9 / 10))
+X_EXPR="i / 10000"
+Y_EXPR="i % 10000"
+XK_EXPR="iif(i < $DENSE, i / 1000, i / 64000)"
+YK_EXPR="iif(i < $DENSE, i % 1000, 1000 * (1 + i % 64) + (i / 64) % 1000)"
+S16=`printf 'x%.0s' $(seq 16)`
+S256=`printf 'x%.0s' $(seq 256)`
+
+list_arrays()
+{
+    iquery -otsv -aq "project(list('arrays'), name)" 2>/dev/null
+}
+
+generate()
+{
+    echo "generating $NUM_CELLS cells"
+    for name in `list_arrays | grep '^fr_perf_'`; do
+        iquery -anq "remove($name)" > /dev/null 2>&1
+    done
+    local vals=""
+    for a in `seq 2 20`; do
+        vals="$vals val$a, double(random()),"
+    done
+    iquery -anq "store(
+     project(
+      sort(
+       apply(
+         build(<val1:double>[i=0:$((NUM_CELLS-1)),100000,0], double(random())),
+         $vals
+         s16,  '$S16',
+         s256, '$S256',
+         x,   $X_EXPR,
+         y,   $Y_EXPR,
+         yq,  ($Y_EXPR) / 4,
+         xk,  $XK_EXPR,
+         yk,  $YK_EXPR,
+         ykq, ($YK_EXPR) / 4,
+         r,   random()
+       ),
+       r, 100000
+      ),
+      $(attr_list 20), s16, s256, x, y, yq, xk, yk, ykq
+     ),
+     fr_perf_random)" || exit 1
+    iquery -anq "store(build(<n:int64>[i=0:0,1,0], $NUM_CELLS), fr_perf_size)" || exit 1
+}
+
+#xdim ydim chunk -> SORTED_INPUT: the input in the order of a target with those dimensions - by x chunk, y chunk, x,
+#y - stored on first use as fr_perf_sorted_<xdim>_<ydim>_<chunk> and kept with the other inputs
+sorted_input()
+{
+    SORTED_INPUT=fr_perf_sorted_$1_$2_$3
+    if ! echo "$EXISTING" | grep -qx "$SORTED_INPUT" ; then
+        iquery -anq "store(project(sort(apply(fr_perf_random, cx, $1 / $3, cy, $2 / $3), cx, cy, $1, $2, 100000), $(attr_list 20), s16, s256, x, y, yq, xk, yk, ykq), $SORTED_INPUT)" || exit 1
+        EXISTING="$EXISTING
+$SORTED_INPUT"
+    fi
+}
+
+attr_list()
+{
+    local result="val1"
+    for a in `seq 2 $1`; do
+        result="$result, val$a"
+    done
+    echo "$result"
+}
+
+#synthetic skew -> the x and y dimensions of the target
+target_dims()
+{
+    local xdim=x
+    local ydim=y
+    if [ $2 = skewed ] ; then
+        xdim=xk
+        ydim=yk
+    fi
+    if [ $1 != none ] ; then
+        ydim=${ydim}q
+    fi
+    echo "$xdim $ydim"
+}
+
+#attrs synthetic string chunk skew -> target schema
+target_schema()
+{
+    local attrs="val1:double"
+    for a in `seq 2 $1`; do
+        attrs="$attrs, val$a:double"
+    done
+    if [ $3 -ne 0 ] ; then
+        attrs="$attrs, s$3:string"
+    fi
+    set -- $1 $2 $3 $4 $5 `target_dims $2 $5`
+    local dims="$6=0:*,$4,0, $7=0:*,$4,0"
+    case $2 in
+        first) dims="synthetic=0:3,4,0, $dims" ;;
+        last)  dims="$dims, synthetic=0:3,4,0" ;;
+    esac
+    echo "<$attrs>[$dims]"
+}
+
+#seconds taken by the fastest of REPEATS runs of a query
+time_query()
+{
+    local best=
+    for r in `seq 1 $REPEATS`; do
+        local start=`date +%s.%N`
+        if ! iquery -anq "$1" > /dev/null 2>&1 ; then
+            echo "FAILED"
+            return
+        fi
+        local end=`date +%s.%N`
+        best=`echo "$start $end $best" | awk '{t = $2 - $1; if ($3 != "" && $3 < t) t = $3; printf "%.3f", t}'`
+    done
+    echo $best
+}
+
+existing_size=`iquery -otsv -aq "scan(fr_perf_size)" 2>/dev/null`
+if [ $REGENERATE -ne 0 ] || [ "$existing_size" != "$NUM_CELLS" ] ; then
+    generate
+fi
+EXISTING=`list_arrays | grep '^fr_perf_sorted_'`
+
+CASES=()
+if [ $FULL -ne 0 ] ; then
+    for attrs in 1 5 20; do for order in sorted random; do for synth in none first last; do
+    for str in 0 16 256; do for chunk in 100 1000; do for skew in uniform skewed; do
+        CASES+=("$attrs $order $synth $str $chunk $skew")
+    done; done; done; done; done; done
+else
+    CASES+=("5 random none 0 1000 uniform")
+    for attrs in 1 20;          do CASES+=("$attrs random none 0 1000 uniform"); done
+    CASES+=("5 sorted none 0 1000 uniform")
+    for synth in first last;    do CASES+=("5 random $synth 0 1000 uniform"); done
+    for str in 16 256;          do CASES+=("5 random none $str 1000 uniform"); done
+    CASES+=("5 random none 0 100 uniform")
+    CASES+=("5 random none 0 1000 skewed")
+fi
+
+echo "case,attrs,order,synthetic,string,chunk,skew,cells,operator,seconds" > $OUTFILE
+for c in "${CASES[@]}"; do
+    set -- $c
+    name="a$1_$2_syn-$3_s$4_c$5_$6"
+    if ! echo "$name" | grep -qE "$FILTER" ; then
+        continue
+    fi
+    schema=`target_schema $1 $3 $4 $5 $6`
+    input=fr_perf_random
+    if [ $2 = sorted ] ; then
+        sorted_input `target_dims $3 $6` $5
+        input=$SORTED_INPUT
+    fi
+    for op in redimension faster_redimension; do
+        seconds=`time_query "consume($op($input, $schema))"`
+        echo "$name,$1,$2,$3,$4,$5,$6,$NUM_CELLS,$op,$seconds" >> $OUTFILE
+        printf "%-40s %-20s %s\n" "$name" "$op" "$seconds"
+    done
+done
+
+if [ -n "$JSONFILE" ] ; then
+    awk -F, 'NR == 1 { split($0, keys, ","); next }
+             { printf "%s  {", (NR == 2 ? "[\n" : ",\n");
+               for (i = 1; i <= NF; ++i) {
+                   quote = ($i ~ /^[0-9.]+$/) ? "" : "\"";
+                   printf "%s\"%s\": %s%s%s", (i > 1 ? ", " : ""), keys[i], quote, $i, quote
+               }
+               printf "}" }
+             END { print (NR > 1 ? "\n]" : "[]") }' $OUTFILE > $JSONFILE
+fi
+
+echo
+echo "faster_redimension slower than redimension:"
+awk -F, 'NR > 1 { t[$1 "," $9] = $10; names[$1] = 1 }
+         END { n = 0;
+               for (c in names) {
+                   r = t[c ",redimension"]; f = t[c ",faster_redimension"];
+                   if (r + 0 > 0 && f + 0 > r + 0) { printf "  %-40s %.2fx\n", c, f / r; ++n }
+               }
+               if (n == 0) print "  none" }' $OUTFILE
+
+if [ -n "$BASELINE" ] ; then
+    echo
+    echo "against $BASELINE (tolerance $TOLERANCE%):"
+    awk -F, -v tol=$TOLERANCE \
+        'FNR == 1 { next }
+         NR == FNR { base[$1 "," $9] = $10; cells[$1 "," $9] = $8; next }
+         { key = $1 "," $9;
+           if (!(key in base)) { printf "  %-40s %-20s new\n", $1, $9; next }
+           if (cells[key] != $8) { printf "  %-40s %-20s baseline has %s cells, skipped\n", $1, $9, cells[key]; next }
+           if (base[key] == "FAILED" || $10 == "FAILED" || base[key] + 0 == 0) { printf "  %-40s %-20s %s -> %s\n", $1, $9, base[key], $10; next }
+           ratio = $10 / base[key];
+           flag = ratio > 1 + tol / 100 ? "REGRESSION" : "";
+           if (flag != "") ++regressions;
+           printf "  %-40s %-20s %8.3f -> %8.3f  %.2fx %s\n", $1, $9, base[key], $10, ratio, flag }
+         END { exit (regressions > 0) }' $BASELINE $OUTFILE
+    exit $?
+fi
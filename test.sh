@@ -9,7 +9,16 @@ EXPFILE=$MYDIR/test.expected
 rm -rf $OUTFILE > /dev/null 2>&1
 
 iquery -anq "remove(foo)" > /dev/null 2>&1
+iquery -anq "remove(bar)" > /dev/null 2>&1
+iquery -anq "remove(baz)" > /dev/null 2>&1
+iquery -anq "remove(qux)" > /dev/null 2>&1
+iquery -anq "remove(quux)" > /dev/null 2>&1
+iquery -anq "remove(autoc)" > /dev/null 2>&1
 iquery -anq "store(build(<a:double,b:string,c:int64,x:int64>[i=1:10,3,0], '[(1.1,a,0,0),(2.2,b,1,null),(3.3,c,null,2),(4.4,d,null,null),(5.5,f,4,3),(6.6,g,4,4),(7.7,h,4,5),(8.8,null,4,6),(9.9,i,0,7),(10.1,k,0,8)]', true), foo)" > /dev/null 2>&1
+iquery -anq "store(build(<v:int64>[i=0:3,2,0,j=0:3,2,0], i*4+j), bar)" > /dev/null 2>&1
+iquery -anq "store(apply(build(<v:int64>[i=0:7,8,0], i), x, i % 3), baz)" > /dev/null 2>&1
+iquery -anq "store(apply(build(<n:int64>[i=0:7999,1000,0], i), v, iif(i % 7 = 0, null, i), x, i % 23 - 11, y, (i * 7) % 17 - 8), qux)" > /dev/null 2>&1
+iquery -anq "store(apply(build(<n:int64>[i=0:1999,500,0], i), x, i % 40, y, i / 40, b, iif(i % 5 = 0, null, i % 3 = 0), s, iif(i % 4 = 0, 'xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx' + string(i), iif(i % 4 = 1, '', iif(i % 4 = 2, null, string(i))))), quux)" > /dev/null 2>&1
 
 iquery -aq "faster_redimension(foo, <a:double>[c=0:*,1,0,x=0:*,1,0])" >> $OUTFILE 2>&1
 iquery -aq "faster_redimension(foo, <a:double>[c=0:*,1,0,x=0:*,2,0])" >> $OUTFILE 2>&1
@@ -21,5 +30,108 @@ iquery -aq "faster_redimension(foo, <b:string>[x=0:*,4,0])" >> $OUTFILE 2>&1
 iquery -aq "sort(unpack(faster_redimension(foo, <b:string>[c=0:*,4,0, synthetic=5:*,10,0]), i), c,synthetic)" >> $OUTFILE 2>&1
 iquery -aq "sort(unpack(faster_redimension(foo, <a:double, b:string>[synthetic=3:*,10,0, c=0:*,4,0]), i), c, synthetic)" >> $OUTFILE 2>&1
 
+#already sorted input: the local sort is skipped
+iquery -aq "faster_redimension(faster_redimension(foo, <a:double>[c=0:*,1,0,x=0:*,1,0]), <a:double>[c=0:*,1,0,x=0:*,1,0])" >> $OUTFILE 2>&1
+#the outer redimension sorted nothing
+iquery -aq "aggregate(apply(faster_redimension_stats(), s, iif(name='sort', tuples, uint64(0)), n, iif(name='scan', tuples, uint64(0))), sum(s) as sorted, sum(n) as scanned)" >> $OUTFILE 2>&1
+
+#multi-threaded local sort
+iquery -aq "faster_redimension(foo, <a:double, b:string>[c=0:*,3,0,x=0:*,2,0], 'sort_threads=2')" >> $OUTFILE 2>&1
+iquery -aq "faster_redimension(foo, <a:double, b:string>[c=0:*,3,0,x=0:*,2,0], 'sort_engine=comparison')" >> $OUTFILE 2>&1
+
+#radix and comparison engines agree on runs past RADIX_MIN_TUPLES: negative and repeated coordinates, nulls
+iquery -aq "aggregate(faster_redimension(qux, <v:int64 null>[x=-11:11,8,0, y=-8:8,8,0, synthetic=0:*,32,0], 'sort_engine=radix'), count(*) as cells, count(v) as nonnull)" >> $OUTFILE 2>&1
+iquery -aq "aggregate(filter(join(faster_redimension(qux, <v:int64 null>[x=-11:11,8,0, y=-8:8,8,0, synthetic=0:*,32,0], 'sort_engine=radix'), project(apply(faster_redimension(qux, <v:int64 null>[x=-11:11,8,0, y=-8:8,8,0, synthetic=0:*,32,0], 'sort_engine=comparison'), w, v), w)), v <> w or (v is null) <> (w is null)), count(*) as mismatches)" >> $OUTFILE 2>&1
+
+#columnar SG batches
+iquery -aq "faster_redimension(foo, <a:double, b:string>[c=0:*,10,0,x=0:*,10,0], 'sg_format=columnar')" >> $OUTFILE 2>&1
+
+#no input attributes read: coordinates only
+iquery -aq "sort(project(unpack(faster_redimension(bar, <i:int64>[j=0:3,4,0, synthetic=0:3,4,0]), n), j, i), j, i)" >> $OUTFILE 2>&1
+
+#scatter before sort
+iquery -aq "faster_redimension(foo, <a:double, b:string>[c=0:*,3,0,x=0:*,2,0], 'strategy=scatter')" >> $OUTFILE 2>&1
+
+#scatter sends unsorted tuple blobs only: other layouts are refused
+iquery -aq "faster_redimension(foo, <a:double, b:string>[c=0:*,3,0,x=0:*,2,0], 'strategy=scatter', 'sg_format=columnar')" 2>&1 | grep -c "sg_format does not go with strategy=scatter" >> $OUTFILE
+
+#sort by destination, SG as each destination is ready
+iquery -aq "faster_redimension(foo, <a:double, b:string>[c=0:*,3,0,x=0:*,2,0], 'strategy=pipelined')" >> $OUTFILE 2>&1
+
+#pipelined over a budget much smaller than the input: sorted runs are written out, and every cell still arrives once
+iquery -aq "aggregate(faster_redimension(apply(build(<v:int64>[i=0:199999,50000,0], i), x, i % 1000, y, i / 1000), <v:int64>[x=0:*,100,0, y=0:*,100,0], 'strategy=pipelined', 'memory_budget_bytes=1048576'), count(*) as cells, sum(v) as total)" >> $OUTFILE 2>&1
+
+#delta-encoded SG blobs
+iquery -aq "faster_redimension(foo, <a:double, b:string>[c=0:*,3,0,x=0:*,2,0], 'sg_format=delta')" >> $OUTFILE 2>&1
+iquery -aq "sort(project(unpack(faster_redimension(bar, <i:int64>[j=0:3,4,0, synthetic=0:3,4,0], 'sg_format=delta'), n), j, i), j, i)" >> $OUTFILE 2>&1
+
+#compressed SG blobs
+iquery -aq "faster_redimension(foo, <a:double, b:string>[c=0:*,3,0,x=0:*,2,0], 'sg_compression=lz')" >> $OUTFILE 2>&1
+iquery -aq "faster_redimension(foo, <a:double, b:string>[c=0:*,10,0,x=0:*,10,0], 'sg_compression=lz', 'strategy=scatter')" >> $OUTFILE 2>&1
+
+#output chunks built directly as RLE: runs of null and non-null bools packed as bits, empty strings and strings over 255 bytes behind a 5-byte size
+iquery -aq "aggregate(join(faster_redimension(quux, <b:bool null, s:string null>[x=0:39,8,0, y=0:49,10,0], 'output_writer=rle'), project(apply(faster_redimension(quux, <b:bool null, s:string null>[x=0:39,8,0, y=0:49,10,0]), c, b, t, s), c, t)), count(*) as cells, sum(iif(strlen(iif(s is null, '', s)) > 255, 1, 0)) as long_strings, sum(iif(iif(b is null, 2, iif(b, 1, 0)) <> iif(c is null, 2, iif(c, 1, 0)) or iif(s is null, '-', s) <> iif(t is null, '-', t), 1, 0)) as mismatches)" >> $OUTFILE 2>&1
+iquery -aq "aggregate(join(faster_redimension(quux, <b:bool null, s:string null>[synthetic=0:49,10,0, x=0:39,8,0], 'output_writer=rle'), project(apply(faster_redimension(quux, <b:bool null, s:string null>[synthetic=0:49,10,0, x=0:39,8,0]), c, b, t, s), c, t)), count(*) as cells, sum(iif(strlen(iif(s is null, '', s)) > 255, 1, 0)) as long_strings, sum(iif(iif(b is null, 2, iif(b, 1, 0)) <> iif(c is null, 2, iif(c, 1, 0)) or iif(s is null, '-', s) <> iif(t is null, '-', t), 1, 0)) as mismatches)" >> $OUTFILE 2>&1
+
+#attribute chunks of some 100 output chunks written by the worker threads, matching the single-threaded writer
+iquery -aq "aggregate(join(faster_redimension(qux, <v:int64 null, n:int64>[x=-11:11,2,0, y=-8:8,2,0, synthetic=0:*,64,0], 'output_threads=3'), project(apply(faster_redimension(qux, <v:int64 null, n:int64>[x=-11:11,2,0, y=-8:8,2,0, synthetic=0:*,64,0]), w, v, m, n), w, m)), count(*) as cells, sum(iif(iif(v is null, -1, v) <> iif(w is null, -1, w) or n <> m, 1, 0)) as mismatches)" >> $OUTFILE 2>&1
+iquery -aq "aggregate(join(faster_redimension(qux, <v:int64 null, n:int64>[x=-11:11,2,0, y=-8:8,2,0, synthetic=0:*,64,0], 'output_threads=2', 'output_writer=rle'), project(apply(faster_redimension(qux, <v:int64 null, n:int64>[x=-11:11,2,0, y=-8:8,2,0, synthetic=0:*,64,0]), w, v, m, n), w, m)), count(*) as cells, sum(iif(iif(v is null, -1, v) <> iif(w is null, -1, w) or n <> m, 1, 0)) as mismatches)" >> $OUTFILE 2>&1
+
+#merge split into ranges over some 100 SG chunks, the ranges writing one output array: matches the single merge
+iquery -aq "aggregate(join(faster_redimension(qux, <v:int64 null, n:int64>[x=-11:11,2,0, y=-8:8,2,0, synthetic=0:*,64,0], 'merge_threads=4', 'sg_chunk_size_limit_bytes=4096'), project(apply(faster_redimension(qux, <v:int64 null, n:int64>[x=-11:11,2,0, y=-8:8,2,0, synthetic=0:*,64,0]), w, v, m, n), w, m)), count(*) as cells, sum(iif(iif(v is null, -1, v) <> iif(w is null, -1, w) or n <> m, 1, 0)) as mismatches)" >> $OUTFILE 2>&1
+iquery -aq "aggregate(join(faster_redimension(qux, <v:int64 null, n:int64>[x=-11:11,2,0, y=-8:8,2,0, synthetic=0:*,64,0], 'merge_threads=3', 'output_threads=2', 'sg_chunk_size_limit_bytes=4096'), project(apply(faster_redimension(qux, <v:int64 null, n:int64>[x=-11:11,2,0, y=-8:8,2,0, synthetic=0:*,64,0]), w, v, m, n), w, m)), count(*) as cells, sum(iif(iif(v is null, -1, v) <> iif(w is null, -1, w) or n <> m, 1, 0)) as mismatches)" >> $OUTFILE 2>&1
+
+#a 1MB budget for 200000 cells: sort chunks, SG chunks and scatter blobs sized to fit, and every cell still arrives once
+iquery -aq "aggregate(faster_redimension(apply(build(<v:int64>[i=0:199999,50000,0], i), x, i % 1000, y, i / 1000), <v:int64>[x=0:*,100,0, y=0:*,100,0], 'memory_budget_bytes=1048576'), count(*) as cells, sum(v) as total)" >> $OUTFILE 2>&1
+iquery -aq "aggregate(faster_redimension(apply(build(<v:int64>[i=0:199999,50000,0], i), x, i % 1000, y, i / 1000), <v:int64>[x=0:*,100,0, y=0:*,100,0], 'memory_budget_bytes=1048576', 'strategy=scatter'), count(*) as cells, sum(v) as total)" >> $OUTFILE 2>&1
+
+#a small budget cuts the run sorter's input into many runs: the runs held count against it
+iquery -anq "faster_redimension(apply(build(<v:int64>[i=0:199999,50000,0], i), x, i % 1000, y, i / 1000), <v:int64>[x=0:*,100,0, y=0:*,100,0], 'sort_threads=2', 'memory_budget_bytes=2097152')" >> $OUTFILE 2>&1
+iquery -aq "project(apply(aggregate(filter(faster_redimension_stats(), name='sort'), sum(chunks) as runs), many_runs, runs >= 16), many_runs)" >> $OUTFILE 2>&1
+
+#short strings, measured by the first run, pack far more tuples per sorted chunk than string-size-estimation guesses
+iquery -anq "faster_redimension(apply(build(<v:int64>[i=0:9999,2500,0], (i * 7919) % 10000), s, string(i)), <s:string>[v=0:9999,1000,0])" >> $OUTFILE 2>&1
+iquery -aq "project(apply(aggregate(filter(faster_redimension_stats(), name='sorted_chunk_tuples'), max(tuples) as t), sampled, t > 100000), sampled)" >> $OUTFILE 2>&1
+
+#phase counters of the last query: the merge produces every output cell
+iquery -anq "faster_redimension(foo, <a:double, b:string>[c=0:*,3,0,x=0:*,2,0])" >> $OUTFILE 2>&1
+iquery -aq "aggregate(filter(faster_redimension_stats(), name='merge'), sum(tuples))" >> $OUTFILE 2>&1
+
+#the memory peak counts the operator's own buffers: here the staged output chunks
+iquery -anq "faster_redimension(qux, <v:int64 null, n:int64>[x=-11:11,2,0, y=-8:8,2,0, synthetic=0:*,64,0], 'output_threads=2')" >> $OUTFILE 2>&1
+iquery -aq "project(apply(aggregate(aggregate(apply(faster_redimension_stats(), m, iif(name='peak_memory_bytes', int64(bytes), int64(0)), s, iif(name='peak_staging_bytes', int64(bytes), int64(0))), max(m) as m, max(s) as s, instance_id), min(iif(m >= s, 1, 0)) as covered, sum(s) as staged), covers_staging, covered = 1 and staged > 0), covers_staging)" >> $OUTFILE 2>&1
+
+#colliding cells: one input chunk, so first and last follow the scan order
+iquery -aq "faster_redimension(baz, <v:int64>[x=0:*,10,0], 'on_collision=first')" >> $OUTFILE 2>&1
+iquery -aq "faster_redimension(baz, <v:int64>[x=0:*,10,0], 'on_collision=last')" >> $OUTFILE 2>&1
+iquery -aq "aggregate(faster_redimension(baz, <v:int64>[x=0:*,10,0], 'on_collision=any'), count(*))" >> $OUTFILE 2>&1
+
+#colliding cells aggregated: combined as they are packed for the SG (8 cells, 3 positions) and again by the writer
+iquery -aq "faster_redimension(baz, <s:int64 null, n:uint64>[x=0:*,10,0], 'aggregate=sum(v) as s, count(*) as n')" >> $OUTFILE 2>&1
+iquery -aq "faster_redimension(baz, <s:int64 null, n:uint64>[x=0:*,10,0], 'aggregate=sum(v) as s, count(*) as n', 'sg_format=columnar')" >> $OUTFILE 2>&1
+iquery -aq "faster_redimension(baz, <s:int64 null, n:uint64>[x=0:*,10,0], 'aggregate=sum(v) as s, count(*) as n', 'sg_format=delta')" >> $OUTFILE 2>&1
+iquery -aq "aggregate(filter(faster_redimension_stats(), name='sg_pack'), sum(tuples) as packed)" >> $OUTFILE 2>&1
+#count(*) alone reads no input attribute and goes out in fixed size blobs, combined the same way; bar has at most 2 i values per chunk
+iquery -aq "faster_redimension(bar, <n:uint64>[i=0:3,4,0], 'aggregate=count(*) as n')" >> $OUTFILE 2>&1
+iquery -aq "project(apply(aggregate(filter(faster_redimension_stats(), name='sg_pack'), sum(tuples) as packed), combined, packed <= 8), combined)" >> $OUTFILE 2>&1
+iquery -aq "faster_redimension(baz, <lo:int64 null, hi:int64 null, m:double null>[x=0:*,10,0], 'aggregate=min(v) as lo, max(v) as hi, avg(v) as m', 'strategy=scatter')" >> $OUTFILE 2>&1
+
+#auto-chunked target: one chunk by default, several when the target is small
+iquery -aq "faster_redimension(foo, <a:double, b:string>[c=0:*,*,0,x=0:*,*,0])" >> $OUTFILE 2>&1
+iquery -anq "store(faster_redimension(foo, <a:double, b:string>[c=0:*,*,0,x=0:*,*,0]), autoc)" > /dev/null 2>&1
+iquery -aq "project(dimensions(autoc), name, chunk_interval)" >> $OUTFILE 2>&1
+iquery -anq "remove(autoc)" > /dev/null 2>&1
+iquery -anq "store(faster_redimension(foo, <a:double, b:string>[c=0:*,*,0,x=0:*,*,0], 'target_cells_per_chunk=2'), autoc)" > /dev/null 2>&1
+iquery -aq "aggregate(autoc, count(*))" >> $OUTFILE 2>&1
+iquery -aq "project(dimensions(autoc), name, chunk_interval)" >> $OUTFILE 2>&1
+
+#c has 2 distinct values: at 1 cell per chunk it is cut in 2 and x takes the rest; an explicit c interval leaves x its share
+iquery -anq "remove(autoc)" > /dev/null 2>&1
+iquery -anq "store(faster_redimension(foo, <a:double, b:string>[c=0:*,*,0,x=0:*,*,0], 'target_cells_per_chunk=1'), autoc)" > /dev/null 2>&1
+iquery -aq "project(dimensions(autoc), name, chunk_interval)" >> $OUTFILE 2>&1
+iquery -anq "remove(autoc)" > /dev/null 2>&1
+iquery -anq "store(faster_redimension(foo, <a:double, b:string>[c=0:*,1,0,x=0:*,*,0], 'target_cells_per_chunk=2'), autoc)" > /dev/null 2>&1
+iquery -aq "project(dimensions(autoc), name, chunk_interval)" >> $OUTFILE 2>&1
+
 diff $OUTFILE $EXPFILE
 